@@ -0,0 +1,269 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "benchmark/trace.h"
+
+// Differential testing of the trees against a brute-force reference: the same randomized
+// operation stream is applied to every engine and the result set of every search is reduced
+// to an order-independent digest, which must match the reference's.
+namespace differential {
+
+using trace::Kind;
+using trace::TraceOp;
+
+inline uint64_t mix64(uint64_t z) {
+    z += 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+struct Digest {
+    uint64_t count = 0;
+    uint64_t hash = 0;
+
+    bool operator==(const Digest& other) const {
+        return count == other.count && hash == other.hash;
+    }
+    bool operator!=(const Digest& other) const { return !(*this == other); }
+
+    // Sums a strong mix of every id, so the digest does not depend on result order.
+    void add(uint64_t id) {
+        hash += mix64(id);
+        count++;
+    }
+};
+
+// Deterministic stream of 2-d operations: for the same parameters every instance yields the
+// same operations. Removes and updates always name a live entry by its current rectangle,
+// and no two live entries share a rectangle, so removing by rectangle is unambiguous.
+class OpStream {
+   public:
+    struct Params {
+        size_t ops = 10000000;
+        unsigned seed = 1;
+        long long space = 1 << 20;  // coordinates are drawn from [0, space)
+        long long max_extent = 64;  // entries are boxes up to this wide
+        long long max_window = 4096;
+        // out of 100: searches, inserts, removes; the rest are updates
+        int search_pct = 40, insert_pct = 35, remove_pct = 12;
+    };
+
+    explicit OpStream(Params params) : params(params), rng(params.seed) {}
+
+    bool next(TraceOp& op) {
+        if (produced == params.ops)
+            return false;
+        produced++;
+        int roll = int(rng() % 100);
+        if (live.empty() && roll >= params.search_pct)
+            roll = params.search_pct;  // nothing to remove or move yet
+        if (roll < params.search_pct) {
+            op.kind = Kind::search;
+            op.id = 0;
+            auto side = 1 + (long long)(rng() % params.max_window);
+            op.lo = {coord(), coord()};
+            op.hi = {op.lo[0] + side, op.lo[1] + side};
+        } else if (roll < params.search_pct + params.insert_pct) {
+            op.kind = Kind::insert;
+            op.id = next_id++;
+            fresh_box(op.lo, op.hi);
+            index[op.id] = live.size();
+            live.push_back({op.id, {op.lo, op.hi}});
+        } else {
+            size_t at = rng() % live.size();
+            auto& [id, box] = live[at];
+            op.id = id;
+            op.lo = box.first;
+            op.hi = box.second;
+            taken.erase(key(op.lo, op.hi));
+            if (roll < params.search_pct + params.insert_pct + params.remove_pct) {
+                op.kind = Kind::remove;
+                index[live.back().first] = at;
+                index.erase(id);
+                std::swap(live[at], live.back());
+                live.pop_back();
+            } else {
+                op.kind = Kind::update;
+                fresh_box(op.to_lo, op.to_hi);
+                box = {op.to_lo, op.to_hi};
+                return true;
+            }
+        }
+        op.to_lo.clear();
+        op.to_hi.clear();
+        return true;
+    }
+
+    size_t live_count() const { return live.size(); }
+
+   private:
+    using Box = std::pair<std::vector<long long>, std::vector<long long>>;
+
+    Params params;
+    std::mt19937_64 rng;
+    size_t produced = 0;
+    uint64_t next_id = 0;
+    std::vector<std::pair<uint64_t, Box>> live;
+    std::unordered_map<uint64_t, size_t> index;  // id -> position in live
+    std::unordered_set<uint64_t> taken;          // keys of the live rectangles
+
+    long long coord() { return (long long)(rng() % uint64_t(params.space)); }
+
+    static uint64_t key(const std::vector<long long>& lo, const std::vector<long long>& hi) {
+        uint64_t h = 0;
+        for (auto v : {lo[0], lo[1], hi[0], hi[1]}) h = mix64(h ^ uint64_t(v));
+        return h;
+    }
+
+    void fresh_box(std::vector<long long>& lo, std::vector<long long>& hi) {
+        do {
+            lo = {coord(), coord()};
+            hi = {lo[0] + (long long)(rng() % params.max_extent),
+                  lo[1] + (long long)(rng() % params.max_extent)};
+        } while (!taken.insert(key(lo, hi)).second);
+    }
+};
+
+// Brute-force reference: entries are bucketed in a uniform grid and a search checks every
+// entry in the cells the window touches.
+class GridReference {
+   public:
+    explicit GridReference(long long cell = 4096) : cell(cell) {}
+
+    void insert(uint64_t id, const std::vector<long long>& lo, const std::vector<long long>& hi) {
+        boxes[id] = {lo, hi};
+        for_cells(lo, hi, [&](uint64_t c) { cells[c].push_back(id); });
+    }
+
+    void remove(uint64_t id) {
+        auto it = boxes.find(id);
+        if (it == boxes.end())
+            return;
+        for_cells(it->second.first, it->second.second, [&](uint64_t c) {
+            auto& ids = cells[c];
+            ids.erase(std::find(ids.begin(), ids.end(), id));
+        });
+        boxes.erase(it);
+    }
+
+    template <typename Visit>
+    void search(const std::vector<long long>& lo, const std::vector<long long>& hi,
+                Visit visit) const {
+        for_cells(lo, hi, [&](uint64_t c) {
+            auto it = cells.find(c);
+            if (it == cells.end())
+                return;
+            for (auto id : it->second) {
+                auto& [blo, bhi] = boxes.at(id);
+                if (blo[0] > hi[0] || bhi[0] < lo[0] || blo[1] > hi[1] || bhi[1] < lo[1])
+                    continue;
+                // an entry spanning several cells is reported from the first one the window
+                // shares with it
+                long long x = std::max(blo[0], lo[0]) / cell, y = std::max(blo[1], lo[1]) / cell;
+                if (c == cell_key(x, y))
+                    visit(id);
+            }
+        });
+    }
+
+   private:
+    long long cell;
+    std::unordered_map<uint64_t, std::vector<uint64_t>> cells;
+    std::unordered_map<uint64_t, std::pair<std::vector<long long>, std::vector<long long>>> boxes;
+
+    static uint64_t cell_key(long long x, long long y) {
+        return (uint64_t(uint32_t(x)) << 32) | uint32_t(y);
+    }
+
+    template <typename Fn>
+    void for_cells(const std::vector<long long>& lo, const std::vector<long long>& hi,
+                   Fn fn) const {
+        for (long long x = lo[0] / cell; x <= hi[0] / cell; x++) {
+            for (long long y = lo[1] / cell; y <= hi[1] / cell; y++) fn(cell_key(x, y));
+        }
+    }
+};
+
+struct EngineReport {
+    std::string name;
+    size_t ops = 0;
+    size_t searches = 0;
+    size_t mismatches = 0;
+    size_t first_mismatch = SIZE_MAX;  // index of the first diverging op in the stream
+    double seconds = 0;
+
+    double throughput() const { return seconds > 0 ? ops / seconds : 0; }
+};
+
+// Runs the stream on the grid reference and returns the digest of every search in order.
+inline std::vector<Digest> run_reference(const OpStream::Params& params, EngineReport& report) {
+    std::vector<Digest> digests;
+    GridReference grid;
+    OpStream stream(params);
+    report.name = "Grid";
+    auto start = std::chrono::steady_clock::now();
+    for (TraceOp op; stream.next(op); report.ops++) {
+        if (op.kind == Kind::search) {
+            Digest d;
+            grid.search(op.lo, op.hi, [&](uint64_t id) { d.add(id); });
+            digests.push_back(d);
+            continue;
+        }
+        grid.remove(op.id);
+        if (op.kind == Kind::insert)
+            grid.insert(op.id, op.lo, op.hi);
+        else if (op.kind == Kind::update)
+            grid.insert(op.id, op.to_lo, op.to_hi);
+    }
+    report.searches = digests.size();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    report.seconds = elapsed.count();
+    return digests;
+}
+
+// Runs the stream on `tree`, whose payloads are the entry ids, and compares every search with
+// the reference digests. make_rect(lo, hi) builds the tree's rectangle type.
+template <typename Tree, typename MakeRect>
+EngineReport run_engine(const std::string& name, Tree& tree, const OpStream::Params& params,
+                        const std::vector<Digest>& expected, MakeRect make_rect) {
+    EngineReport report;
+    report.name = name;
+    std::deque<uint64_t> payloads;  // id -> payload, addresses stay put
+    OpStream stream(params);
+    auto start = std::chrono::steady_clock::now();
+    for (TraceOp op; stream.next(op); report.ops++) {
+        auto rect = make_rect(op.lo, op.hi);
+        if (op.kind == Kind::search) {
+            Digest d;
+            for (auto* payload : tree.search(rect)) d.add(*payload);
+            if (report.searches >= expected.size() || d != expected[report.searches]) {
+                report.mismatches++;
+                report.first_mismatch = std::min(report.first_mismatch, report.ops);
+            }
+            report.searches++;
+        } else if (op.kind == Kind::insert) {
+            payloads.push_back(op.id);
+            tree.insert(rect, &payloads.back());
+        } else if (op.kind == Kind::remove) {
+            tree.remove(rect);
+        } else {
+            auto to = make_rect(op.to_lo, op.to_hi);
+            tree.update(rect, to, &payloads[op.id]);
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    report.seconds = elapsed.count();
+    return report;
+}
+
+}  // namespace differential
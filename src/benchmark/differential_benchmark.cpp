@@ -0,0 +1,63 @@
+// Differential validation of both trees against the grid reference at scale.
+//
+//   differential_benchmark [ops] [seed]
+//
+// Applies the same randomized stream of `ops` operations (10M by default) to the grid
+// reference, Gutman::RTree and hilbert::RTree, compares every search result by digest and
+// reports each engine's throughput. Exits with 1 if any engine diverged.
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "benchmark/differential.h"
+#include "rtree/rtree.h"
+#include "rtree_hilbert/hilbert_rtree.h"
+
+namespace {
+
+void report(const differential::EngineReport& r) {
+    std::cout << std::left << std::setw(8) << r.name << std::right << std::setw(12) << r.ops
+              << std::setw(11) << r.searches << std::setw(14) << std::fixed
+              << std::setprecision(0) << r.throughput() << std::setw(12) << r.mismatches;
+    if (r.mismatches)
+        std::cout << "  first at op " << r.first_mismatch;
+    std::cout << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    differential::OpStream::Params params;
+    if (argc > 1)
+        params.ops = std::stoull(argv[1]);
+    if (argc > 2)
+        params.seed = std::stoul(argv[2]);
+
+    std::cout << "engine           ops   searches         ops/s  mismatches" << std::endl;
+    differential::EngineReport grid;
+    auto expected = differential::run_reference(params, grid);
+    report(grid);
+
+    size_t mismatches = 0;
+    {
+        Gutman::RTree<uint64_t> tree(4, 8);
+        auto r = differential::run_engine("Gutman", tree, params, expected,
+                                          [](const auto& lo, const auto& hi) {
+                                              return Gutman::Rectangle(
+                                                  std::vector<double>(lo.begin(), lo.end()),
+                                                  std::vector<double>(hi.begin(), hi.end()));
+                                          });
+        report(r);
+        mismatches += r.mismatches;
+    }
+    {
+        hilbert::RTree<uint64_t> tree(4, 8, 2, 31);
+        auto r = differential::run_engine(
+            "Hilbert", tree, params, expected,
+            [](const auto& lo, const auto& hi) { return hilbert::Rectangle(lo, hi); });
+        report(r);
+        mismatches += r.mismatches;
+    }
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,170 @@
+// Throughput of the HilbertCurve primitives.
+//
+//   hilbert_benchmark [keys]
+//
+// Times index, point, transpose and to_index over `keys` random inputs (200000 by default)
+// for dimensions 2-8 and 8-32 bits per dimension, skipping shapes whose keys do not fit the
+// 63 usable bits of an ll (so 8 dimensions never run at 8 bits or more), then times query()
+// against growing windows in 2 and 3 dimensions, and finally index and point on the runtime
+// curve and StaticHilbertCurve at the shapes 2x31 and 3x21, over the same inputs.
+// Results go to stdout and hilbert_results.csv.
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "rtree_hilbert/hilbert_curve.h"
+#include "rtree_hilbert/static_hilbert_curve.h"
+
+namespace {
+
+// Keeps results alive so the timed loops are not optimised away.
+volatile ll sink;
+
+template <typename Fn>
+double seconds_for(Fn&& fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void report(std::ostream& csv, int dims, int bits, const std::string& op, size_t keys,
+            double seconds) {
+    double ns = seconds * 1e9 / keys;
+    std::cout << std::setw(4) << dims << std::setw(6) << bits << "  " << std::left
+              << std::setw(10) << op << std::right << std::setw(14) << std::fixed
+              << std::setprecision(0) << keys / seconds << std::setw(10) << std::setprecision(1)
+              << ns << std::endl;
+    csv << dims << "," << bits << "," << op << "," << keys / seconds << "," << ns << "\n";
+}
+
+void bench_keys(std::ostream& csv, size_t keys) {
+    std::cout << "dims  bits  op               keys/s    ns/key" << std::endl;
+    std::mt19937_64 rng(1);
+    for (int dims = 2; dims <= 8; dims++) {
+        for (int bits : {8, 16, 24, 32}) {
+            if (dims * bits > 63)
+                continue;
+            HilbertCurve curve(bits, dims);
+            ll coord_mask = (1ll << bits) - 1;
+            ll index_mask = dims * bits == 63 ? INT64_MAX : (1ll << (dims * bits)) - 1;
+
+            std::vector<Point> points(keys, Point(dims));
+            std::vector<ll> indices(keys);
+            for (size_t i = 0; i < keys; i++) {
+                for (auto& c : points[i]) c = ll(rng()) & coord_mask;
+                indices[i] = ll(rng()) & index_mask;
+            }
+
+            ll acc = 0;
+            report(csv, dims, bits, "index", keys, seconds_for([&] {
+                       for (auto& p : points) acc ^= curve.index(p);
+                   }));
+            Point x(dims);
+            report(csv, dims, bits, "point", keys, seconds_for([&] {
+                       for (auto i : indices) {
+                           curve.point(i, x);
+                           acc ^= x[0];
+                       }
+                   }));
+            std::vector<Point> transposed(keys, Point(dims));
+            report(csv, dims, bits, "transpose", keys, seconds_for([&] {
+                       for (size_t i = 0; i < keys; i++) curve.transpose(indices[i], transposed[i]);
+                   }));
+            report(csv, dims, bits, "to_index", keys, seconds_for([&] {
+                       for (auto& t : transposed) acc ^= curve.to_index(t);
+                   }));
+            sink = acc;
+        }
+    }
+}
+
+// The compile-time curve computes the same keys as the runtime one for its fixed shape; both
+// are timed on the same inputs, as "index"/"point" and "s_index"/"s_point" rows.
+template <int Dims, int Bits>
+void bench_static(std::ostream& csv, size_t keys) {
+    static_assert(Dims * Bits <= 63, "The runtime curve needs keys in 63 bits");
+    using Curve = StaticHilbertCurve<Dims, Bits>;
+    std::mt19937_64 rng(3);
+    std::vector<typename Curve::Coords> points(keys);
+    std::vector<Point> runtime_points(keys, Point(Dims));
+    std::vector<ll> indices(keys);
+    for (size_t i = 0; i < keys; i++) {
+        for (int d = 0; d < Dims; d++)
+            runtime_points[i][d] = points[i][d] = ll(rng() & ((1ull << Bits) - 1));
+        indices[i] = ll(rng() >> (64 - Dims * Bits));
+    }
+    ll acc = 0;
+    HilbertCurve curve(Bits, Dims);
+    report(csv, Dims, Bits, "index", keys, seconds_for([&] {
+               for (auto& p : runtime_points) acc ^= curve.index(p);
+           }));
+    Point x(Dims);
+    report(csv, Dims, Bits, "point", keys, seconds_for([&] {
+               for (auto i : indices) {
+                   curve.point(i, x);
+                   acc ^= x[0];
+               }
+           }));
+    report(csv, Dims, Bits, "s_index", keys, seconds_for([&] {
+               for (auto& p : points) acc ^= Curve::index(p);
+           }));
+    report(csv, Dims, Bits, "s_point", keys, seconds_for([&] {
+               for (auto i : indices) acc ^= Curve::point(i)[0];
+           }));
+    sink = acc;
+}
+
+// query() walks the window's boundary and checks the gaps between its keys, so its cost
+// follows the window's surface rather than its volume.
+void bench_query(std::ostream& csv) {
+    std::cout << "\ndims  bits  window    ranges   us/query" << std::endl;
+    std::mt19937_64 rng(2);
+    for (int dims : {2, 3}) {
+        int bits = 16;
+        HilbertCurve curve(bits, dims);
+        for (ll side : {4, 16, 64, 256, 1024}) {
+            if (dims == 3 && side > 256)
+                continue;
+            int queries = side <= 16 ? 200 : side <= 64 ? 20 : 5;
+            size_t ranges = 0;
+            double seconds = seconds_for([&] {
+                for (int q = 0; q < queries; q++) {
+                    Point lo(dims), hi(dims);
+                    for (int d = 0; d < dims; d++) {
+                        lo[d] = ll(rng() % ((1ull << bits) - side));
+                        hi[d] = lo[d] + side - 1;
+                    }
+                    ranges += curve.query(lo, hi, 64).size();
+                }
+            });
+            double us = seconds * 1e6 / queries;
+            std::cout << std::setw(4) << dims << std::setw(6) << bits << std::setw(8) << side
+                      << std::setw(10) << ranges / queries << std::setw(11)
+                      << std::setprecision(1) << us << std::endl;
+            csv << dims << "," << bits << ",query" << side << "," << queries / seconds << ","
+                << us * 1000 << "\n";
+        }
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    size_t keys = argc > 1 ? std::stoul(argv[1]) : 200000;
+    std::ofstream csv("hilbert_results.csv");
+    csv << "Dims,Bits,Op,KeysPerSecond,NsPerKey\n";
+    bench_keys(csv, keys);
+    std::cout << "\ndims  bits  op               keys/s    ns/key  (runtime vs static)"
+              << std::endl;
+    bench_static<2, 31>(csv, keys);
+    bench_static<3, 21>(csv, keys);
+    bench_query(csv);
+    std::cout << "\nResults saved to hilbert_results.csv" << std::endl;
+    return 0;
+}
@@ -0,0 +1,138 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+#include "rtree/latency.h"
+
+namespace mixed {
+
+// One run of the mixed workload. Reader threads only search, writer threads only insert and
+// remove, and mixed threads pick a search with probability read_fraction and a write
+// otherwise, so both "N readers + M writers" and "x% reads from every thread" can be
+// expressed.
+struct Config {
+    unsigned readers = 0;
+    unsigned writers = 0;
+    unsigned mixed = 1;
+    double read_fraction = 0.95;
+    std::chrono::milliseconds duration{1000};
+    size_t initial_entries = 100000;
+    long long space = 1000000;  // coordinates are drawn from [0, space)
+    long long window = 1000;    // side of the search windows
+    unsigned seed = 1;
+
+    unsigned threads() const { return readers + writers + mixed; }
+};
+
+struct Result {
+    Config config;
+    size_t ops = 0;
+    double seconds = 0;
+    // per Gutman::Operation; only search, insert and remove are used. Latencies include the
+    // time spent waiting for the lock.
+    std::array<Gutman::LatencySnapshot, Gutman::operation_count> latency;
+
+    double throughput() const { return seconds > 0 ? ops / seconds : 0; }
+    const Gutman::LatencySnapshot& of(Gutman::Operation op) const { return latency[size_t(op)]; }
+};
+
+// Runs `config` against a fresh tree from make_tree(), which returns it by unique_ptr. The
+// trees are not thread safe, so every search holds a shared lock and every write an exclusive
+// one; that reader-writer locked tree is what is measured. make_rect(lo, hi) builds the tree's
+// rectangle from two corners given as std::vector<long long>. Writers keep the tree's size
+// steady by removing their own earlier inserts about as often as they insert.
+template <typename MakeTree, typename MakeRect>
+Result run(MakeTree make_tree, const Config& config, MakeRect make_rect) {
+    using Corner = std::vector<long long>;
+    auto recorder = std::make_unique<Gutman::LatencyRecorder>();
+    std::shared_mutex lock;
+    std::atomic<bool> stop{false};
+    std::atomic<size_t> total_ops{0};
+
+    // payloads live in deques so pointers handed to the tree stay put, and are declared
+    // before the tree so they outlive it
+    std::deque<uint64_t> preloaded;
+    std::vector<std::deque<uint64_t>> payloads(config.threads());
+    auto tree_ptr = make_tree();
+    auto& tree = *tree_ptr;
+    {
+        std::mt19937_64 rng(config.seed);
+        std::uniform_int_distribution<long long> coord(0, config.space - 1);
+        for (size_t i = 0; i < config.initial_entries; i++) {
+            preloaded.push_back(i);
+            Corner p{coord(rng), coord(rng)};
+            tree.insert(make_rect(p, p), &preloaded.back());
+        }
+    }
+
+    enum class Role { reader, writer, mixed };
+    auto work = [&](Role role, unsigned index) {
+        std::mt19937_64 rng(config.seed * 7919 + index);
+        std::uniform_int_distribution<long long> coord(0, config.space - 1);
+        std::uniform_real_distribution<double> coin(0, 1);
+        auto& own = payloads[index];
+        std::vector<Corner> mine;  // what this thread inserted and has not removed yet
+        size_t ops = 0;
+        for (; !stop.load(std::memory_order_relaxed); ops++) {
+            bool read = role == Role::reader ||
+                        (role == Role::mixed && coin(rng) < config.read_fraction);
+            auto start = std::chrono::steady_clock::now();
+            Gutman::Operation op;
+            if (read) {
+                Corner lo{coord(rng), coord(rng)};
+                Corner hi{lo[0] + config.window, lo[1] + config.window};
+                auto rect = make_rect(lo, hi);
+                std::shared_lock guard(lock);
+                tree.search(rect);
+                op = Gutman::Operation::search;
+            } else if (!mine.empty() && coin(rng) < 0.5) {
+                std::swap(mine[rng() % mine.size()], mine.back());
+                auto rect = make_rect(mine.back(), mine.back());
+                mine.pop_back();
+                std::unique_lock guard(lock);
+                tree.remove(rect);
+                op = Gutman::Operation::remove;
+            } else {
+                mine.push_back({coord(rng), coord(rng)});
+                own.push_back(own.size());
+                auto rect = make_rect(mine.back(), mine.back());
+                std::unique_lock guard(lock);
+                tree.insert(rect, &own.back());
+                op = Gutman::Operation::insert;
+            }
+            recorder->record(op, std::chrono::steady_clock::now() - start);
+        }
+        total_ops += ops;
+    };
+
+    std::vector<std::thread> workers;
+    unsigned index = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < config.readers; i++) workers.emplace_back(work, Role::reader, index++);
+    for (unsigned i = 0; i < config.writers; i++) workers.emplace_back(work, Role::writer, index++);
+    for (unsigned i = 0; i < config.mixed; i++) workers.emplace_back(work, Role::mixed, index++);
+    std::this_thread::sleep_for(config.duration);
+    stop = true;
+    auto end = std::chrono::steady_clock::now();
+    for (auto& worker : workers) worker.join();
+
+    Result result;
+    result.config = config;
+    result.ops = total_ops;
+    result.seconds = std::chrono::duration<double>(end - start).count();
+    for (size_t op = 0; op < Gutman::operation_count; op++)
+        result.latency[op] = recorder->snapshot(Gutman::Operation(op));
+    return result;
+}
+
+}  // namespace mixed
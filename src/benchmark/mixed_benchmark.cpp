@@ -0,0 +1,105 @@
+// Mixed read/write throughput of both trees under concurrent load.
+//
+//   mixed_benchmark [duration_ms] [readers writers]
+//
+// Runs 95/5, 50/50 and 10/90 read/write mixes on 1, 2, 4, ... up to all cores, and when
+// readers and writers are given also a run with that many dedicated reader and writer
+// threads. Results go to stdout and mixed_results.csv.
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchmark/mixed.h"
+#include "rtree/rtree.h"
+#include "rtree_hilbert/hilbert_rtree.h"
+
+namespace {
+
+mixed::Result run_engine(const std::string& engine, const mixed::Config& config) {
+    if (engine == "Gutman") {
+        return mixed::run([] { return std::make_unique<Gutman::RTree<uint64_t>>(4, 8); }, config,
+                          [](const auto& lo, const auto& hi) {
+                              return Gutman::Rectangle(std::vector<double>(lo.begin(), lo.end()),
+                                                       std::vector<double>(hi.begin(), hi.end()));
+                          });
+    }
+    return mixed::run([] { return std::make_unique<hilbert::RTree<uint64_t>>(4, 8, 2, 31); },
+                      config,
+                      [](const auto& lo, const auto& hi) { return hilbert::Rectangle(lo, hi); });
+}
+
+void report(std::ostream& csv, const std::string& engine, const std::string& mix,
+            const mixed::Result& r) {
+    using Gutman::Operation;
+    std::cout << std::left << std::setw(8) << engine << std::setw(8) << mix << std::right
+              << std::setw(4) << r.config.threads() << std::setw(12) << std::fixed
+              << std::setprecision(0) << r.throughput();
+    for (auto op : {Operation::search, Operation::insert, Operation::remove}) {
+        auto& h = r.of(op);
+        std::cout << "  " << Gutman::operation_name(op) << " " << h.percentile(0.5) << "/"
+                  << h.percentile(0.99) << "/" << h.percentile(0.999);
+        csv << "," << h.count() << "," << h.percentile(0.5) << "," << h.percentile(0.99) << ","
+            << h.percentile(0.999);
+    }
+    std::cout << std::endl;
+    csv << "\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    mixed::Config base;
+    if (argc > 1)
+        base.duration = std::chrono::milliseconds(std::stol(argv[1]));
+
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned> thread_counts;
+    for (unsigned t = 1; t < cores; t *= 2) thread_counts.push_back(t);
+    thread_counts.push_back(cores);
+
+    std::ofstream csv("mixed_results.csv");
+    csv << "Engine,Mix,Readers,Writers,Mixed,Throughput";
+    for (auto op : {"Search", "Insert", "Remove"})
+        csv << "," << op << "N," << op << "P50," << op << "P99," << op << "P999";
+    csv << "\n";
+    std::cout << "engine  mix     thr  ops/s       p50/p99/p999 in ns" << std::endl;
+
+    auto run = [&](const std::string& engine, const std::string& mix,
+                   const mixed::Config& config) {
+        auto result = run_engine(engine, config);
+        csv << engine << "," << mix << "," << config.readers << "," << config.writers << ","
+            << config.mixed << "," << result.throughput();
+        report(csv, engine, mix, result);
+    };
+
+    for (double reads : {0.95, 0.5, 0.1}) {
+        std::string mix = std::to_string(int(reads * 100 + 0.5)) + "/" +
+                          std::to_string(int((1 - reads) * 100 + 0.5));
+        for (unsigned threads : thread_counts) {
+            for (auto engine : {"Gutman", "Hilbert"}) {
+                auto config = base;
+                config.read_fraction = reads;
+                config.mixed = threads;
+                run(engine, mix, config);
+            }
+        }
+    }
+
+    if (argc > 3) {
+        auto config = base;
+        config.readers = std::stoul(argv[2]);
+        config.writers = std::stoul(argv[3]);
+        config.mixed = 0;
+        std::string mix =
+            std::to_string(config.readers) + "R+" + std::to_string(config.writers) + "W";
+        for (auto engine : {"Gutman", "Hilbert"}) run(engine, mix, config);
+    }
+    std::cout << "\nResults saved to mixed_results.csv" << std::endl;
+    return 0;
+}
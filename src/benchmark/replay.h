@@ -0,0 +1,88 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "benchmark/trace.h"
+#include "rtree/latency.h"
+
+namespace trace {
+
+struct ReplayResult {
+    unsigned threads = 1;
+    size_t ops = 0;
+    double seconds = 0;
+    // per Gutman::Operation, as recorded by the tree itself
+    std::array<Gutman::LatencySnapshot, Gutman::operation_count> latency;
+
+    double throughput() const { return seconds > 0 ? ops / seconds : 0; }
+};
+
+// Replays `ops` against `tree` from `threads` threads and reports throughput and the tree's
+// own per-operation latency histograms. make_rect(lo, hi) turns trace coordinates into the
+// tree's rectangle type; payloads are the trace ids, owned by the replay.
+//
+// The trees are not thread safe, so searches share a reader lock and writes take it
+// exclusively. Threads take operations from a shared cursor, so with more than one thread
+// operations close together in the trace can run in a different order, as concurrent clients
+// would; a remove that overtakes its insert then finds nothing.
+template <typename Tree, typename MakeRect>
+ReplayResult replay(Tree& tree, const std::vector<TraceOp>& ops, unsigned threads,
+                    MakeRect make_rect) {
+    // payloads must outlive the tree's use of them; node-based map keeps them in place
+    std::unordered_map<uint64_t, uint64_t> payloads;
+    for (auto& op : ops) {
+        if (op.kind != Kind::search)
+            payloads.emplace(op.id, op.id);
+    }
+
+    tree.enable_latency_histograms();
+    std::shared_mutex lock;
+    std::atomic<size_t> cursor{0};
+    auto work = [&] {
+        for (size_t i; (i = cursor.fetch_add(1, std::memory_order_relaxed)) < ops.size();) {
+            auto& op = ops[i];
+            if (op.kind == Kind::search) {
+                auto rect = make_rect(op.lo, op.hi);
+                std::shared_lock guard(lock);
+                tree.search(rect);
+                continue;
+            }
+            auto rect = make_rect(op.lo, op.hi);
+            auto* payload = &payloads.at(op.id);
+            std::unique_lock guard(lock);
+            if (op.kind == Kind::insert) {
+                tree.insert(rect, payload);
+            } else if (op.kind == Kind::remove) {
+                tree.remove(rect);
+            } else {
+                auto to = make_rect(op.to_lo, op.to_hi);
+                tree.update(rect, to, payload);
+            }
+        }
+    };
+
+    ReplayResult result;
+    result.threads = std::max(1u, threads);
+    result.ops = ops.size();
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < result.threads; t++) workers.emplace_back(work);
+    work();
+    for (auto& worker : workers) worker.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    result.seconds = elapsed.count();
+
+    for (size_t op = 0; op < Gutman::operation_count; op++)
+        result.latency[op] = tree.latency_histogram(Gutman::Operation(op));
+    return result;
+}
+
+}  // namespace trace
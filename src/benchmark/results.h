@@ -0,0 +1,393 @@
+#pragma once
+#include <sys/utsname.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <istream>
+#include <limits>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Machine-readable benchmark results: named metrics with all their samples, plus the
+// environment and configuration they were taken in, written to and read back from JSON,
+// and a comparison of two result sets using Welch's t-test.
+namespace bench {
+
+struct Metric {
+    std::string name;
+    std::string unit;
+    bool lower_is_better = true;
+    std::vector<double> samples;
+
+    double mean() const {
+        double sum = 0;
+        for (auto s : samples) sum += s;
+        return samples.empty() ? 0 : sum / samples.size();
+    }
+
+    // sample standard deviation; 0 with fewer than two samples
+    double stddev() const {
+        if (samples.size() < 2)
+            return 0;
+        double m = mean(), sum = 0;
+        for (auto s : samples) sum += (s - m) * (s - m);
+        return std::sqrt(sum / (samples.size() - 1));
+    }
+
+    double median() const {
+        if (samples.empty())
+            return 0;
+        auto sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+        size_t n = sorted.size();
+        return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+    }
+
+    double min() const {
+        return samples.empty() ? 0 : *std::min_element(samples.begin(), samples.end());
+    }
+    double max() const {
+        return samples.empty() ? 0 : *std::max_element(samples.begin(), samples.end());
+    }
+};
+
+// Minimal JSON value, enough for the files Results writes.
+struct Json {
+    enum Type { null, boolean, number, string, array, object } type = null;
+    bool b = false;
+    double num = 0;
+    std::string str;
+    std::vector<Json> items;
+    std::vector<std::pair<std::string, Json>> members;
+
+    const Json* find(const std::string& key) const {
+        for (auto& [k, v] : members) {
+            if (k == key)
+                return &v;
+        }
+        return nullptr;
+    }
+
+    static Json parse(std::istream& in) {
+        Json value = parse_value(in);
+        if ((in >> std::ws).peek() != std::char_traits<char>::eof())
+            throw std::runtime_error("trailing characters after JSON value");
+        return value;
+    }
+
+   private:
+    static char expect(std::istream& in, char c) {
+        if ((in >> std::ws).get() != c)
+            throw std::runtime_error(std::string("malformed JSON, expected '") + c + "'");
+        return c;
+    }
+
+    static void expect_word(std::istream& in, const char* word) {
+        for (const char* p = word; *p; p++) {
+            if (in.get() != *p)
+                throw std::runtime_error("malformed JSON literal");
+        }
+    }
+
+    static std::string parse_string(std::istream& in) {
+        expect(in, '"');
+        std::string out;
+        for (int c; (c = in.get()) != '"';) {
+            if (c == std::char_traits<char>::eof())
+                throw std::runtime_error("unterminated JSON string");
+            if (c != '\\') {
+                out += char(c);
+                continue;
+            }
+            switch (c = in.get()) {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case 'r': out += '\r'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'u': {
+                    char hex[5] = {};
+                    in.read(hex, 4);
+                    unsigned code = std::stoul(hex, nullptr, 16);
+                    out += code < 0x80 ? char(code) : '?';  // only ASCII is ever written
+                    break;
+                }
+                default: out += char(c);
+            }
+        }
+        return out;
+    }
+
+    static Json parse_value(std::istream& in) {
+        Json v;
+        int c = (in >> std::ws).peek();
+        if (c == '{') {
+            v.type = object;
+            in.get();
+            if ((in >> std::ws).peek() == '}')
+                return in.get(), v;
+            do {
+                auto key = parse_string(in);
+                expect(in, ':');
+                v.members.emplace_back(std::move(key), parse_value(in));
+            } while ((in >> std::ws).peek() == ',' && in.get());
+            expect(in, '}');
+        } else if (c == '[') {
+            v.type = array;
+            in.get();
+            if ((in >> std::ws).peek() == ']')
+                return in.get(), v;
+            do {
+                v.items.push_back(parse_value(in));
+            } while ((in >> std::ws).peek() == ',' && in.get());
+            expect(in, ']');
+        } else if (c == '"') {
+            v.type = string;
+            v.str = parse_string(in);
+        } else if (c == 't' || c == 'f') {
+            v.type = boolean;
+            v.b = c == 't';
+            expect_word(in, v.b ? "true" : "false");
+        } else if (c == 'n') {
+            expect_word(in, "null");
+        } else {
+            v.type = number;
+            if (!(in >> v.num))
+                throw std::runtime_error("malformed JSON number");
+        }
+        return v;
+    }
+};
+
+inline std::string json_escape(const std::string& s) {
+    std::string out;
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += char(c);
+        } else if (c < 0x20 || c >= 0x80) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += char(c);
+        }
+    }
+    return out;
+}
+
+class Results {
+   public:
+    std::map<std::string, std::string> environment = current_environment();
+    std::map<std::string, std::string> config;
+
+    // Appends one sample to metric `name`, creating it on first use.
+    void add(const std::string& name, const std::string& unit, double sample,
+             bool lower_is_better = true) {
+        auto it = std::find_if(list.begin(), list.end(),
+                               [&](const Metric& m) { return m.name == name; });
+        if (it == list.end()) {
+            list.push_back({name, unit, lower_is_better, {}});
+            it = list.end() - 1;
+        }
+        it->samples.push_back(sample);
+    }
+
+    const std::vector<Metric>& metrics() const { return list; }
+
+    const Metric* find(const std::string& name) const {
+        for (auto& m : list) {
+            if (m.name == name)
+                return &m;
+        }
+        return nullptr;
+    }
+
+    void write_json(std::ostream& out) const {
+        auto write_map = [&](const std::map<std::string, std::string>& map) {
+            out << "{";
+            const char* sep = "";
+            for (auto& [k, v] : map) {
+                out << sep << "\n    \"" << json_escape(k) << "\": \"" << json_escape(v) << "\"";
+                sep = ",";
+            }
+            out << "\n  }";
+        };
+        auto old_precision = out.precision(17);
+        out << "{\n  \"environment\": ";
+        write_map(environment);
+        out << ",\n  \"config\": ";
+        write_map(config);
+        out << ",\n  \"metrics\": [";
+        const char* sep = "";
+        for (auto& m : list) {
+            out << sep << "\n    {\"name\": \"" << json_escape(m.name) << "\", \"unit\": \""
+                << json_escape(m.unit)
+                << "\", \"lower_is_better\": " << (m.lower_is_better ? "true" : "false")
+                << ", \"mean\": " << m.mean() << ", \"stddev\": " << m.stddev()
+                << ", \"min\": " << m.min() << ", \"median\": " << m.median()
+                << ", \"max\": " << m.max() << ", \"samples\": [";
+            for (size_t i = 0; i < m.samples.size(); i++) out << (i ? ", " : "") << m.samples[i];
+            out << "]}";
+            sep = ",";
+        }
+        out << "\n  ]\n}\n";
+        out.precision(old_precision);
+    }
+
+    static Results read_json(std::istream& in) {
+        Json root = Json::parse(in);
+        Results results;
+        results.environment.clear();
+        auto read_map = [](const Json* obj, std::map<std::string, std::string>& map) {
+            if (!obj)
+                return;
+            for (auto& [k, v] : obj->members) map[k] = v.str;
+        };
+        read_map(root.find("environment"), results.environment);
+        read_map(root.find("config"), results.config);
+        auto metrics = root.find("metrics");
+        if (!metrics || metrics->type != Json::array)
+            throw std::runtime_error("benchmark results without a metrics array");
+        for (auto& item : metrics->items) {
+            Metric m;
+            auto field = [&](const char* key) {
+                auto v = item.find(key);
+                if (!v)
+                    throw std::runtime_error(std::string("metric without ") + key);
+                return v;
+            };
+            m.name = field("name")->str;
+            m.unit = field("unit")->str;
+            m.lower_is_better = field("lower_is_better")->b;
+            for (auto& s : field("samples")->items) m.samples.push_back(s.num);
+            results.list.push_back(std::move(m));
+        }
+        return results;
+    }
+
+    static std::map<std::string, std::string> current_environment() {
+        std::map<std::string, std::string> env;
+#if defined(__clang__)
+        env["compiler"] = "clang " __clang_version__;
+#elif defined(__GNUC__)
+        env["compiler"] = "gcc " __VERSION__;
+#endif
+#ifdef NDEBUG
+        env["assertions"] = "off";
+#else
+        env["assertions"] = "on";
+#endif
+        env["cores"] = std::to_string(std::thread::hardware_concurrency());
+        utsname uts{};
+        if (uname(&uts) == 0) {
+            env["os"] = std::string(uts.sysname) + " " + uts.release;
+            env["machine"] = uts.machine;
+            env["host"] = uts.nodename;
+        }
+        std::time_t now = std::time(nullptr);
+        char stamp[32];
+        std::strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+        env["time"] = stamp;
+        return env;
+    }
+
+   private:
+    std::vector<Metric> list;
+};
+
+// Regularized incomplete beta function I_x(a, b), by its continued fraction.
+inline double incomplete_beta(double a, double b, double x) {
+    if (x <= 0)
+        return 0;
+    if (x >= 1)
+        return 1;
+    if (x > (a + 1) / (a + b + 2))
+        return 1 - incomplete_beta(b, a, 1 - x);
+    double front = std::exp(std::lgamma(a + b) - std::lgamma(a) - std::lgamma(b) +
+                            a * std::log(x) + b * std::log(1 - x)) /
+                   a;
+    const double tiny = 1e-300;
+    double f = 1, c = 1, d = 0;
+    for (int i = 0; i <= 400; i++) {
+        int m = i / 2;
+        double numerator;
+        if (i == 0)
+            numerator = 1;
+        else if (i % 2 == 0)
+            numerator = m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m));
+        else
+            numerator = -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1));
+        d = 1 + numerator * d;
+        d = 1 / (std::fabs(d) < tiny ? tiny : d);
+        c = 1 + numerator / c;
+        c = std::fabs(c) < tiny ? tiny : c;
+        f *= c * d;
+        if (std::fabs(1 - c * d) < 1e-12)
+            break;
+    }
+    return front * (f - 1);
+}
+
+// Two-sided p-value of Welch's t-test for equal means. NaN when either side has fewer than two
+// samples; with no variance on either side it is 1 for equal means and 0 otherwise.
+inline double welch_p_value(const Metric& a, const Metric& b) {
+    size_t n1 = a.samples.size(), n2 = b.samples.size();
+    if (n1 < 2 || n2 < 2)
+        return std::numeric_limits<double>::quiet_NaN();
+    double v1 = a.stddev() * a.stddev() / n1, v2 = b.stddev() * b.stddev() / n2;
+    double diff = a.mean() - b.mean();
+    if (v1 + v2 == 0)
+        return diff == 0 ? 1 : 0;
+    double t = diff / std::sqrt(v1 + v2);
+    double df = (v1 + v2) * (v1 + v2) / (v1 * v1 / (n1 - 1) + v2 * v2 / (n2 - 1));
+    return incomplete_beta(df / 2, 0.5, df / (df + t * t));
+}
+
+struct Comparison {
+    std::string name;
+    std::string unit;
+    double base_mean = 0, new_mean = 0;
+    double change = 0;  // relative, positive when the new value is larger
+    double p_value = 0;
+    bool significant = false;
+    bool regression = false;   // significantly worse by at least min_change
+    bool improvement = false;  // significantly better by at least min_change
+};
+
+// Compares every metric present in both result sets. A change counts when Welch's test rejects
+// equal means at `alpha` and the means differ by at least `min_change` (relative).
+inline std::vector<Comparison> compare(const Results& base, const Results& current,
+                                       double alpha = 0.05, double min_change = 0.02) {
+    std::vector<Comparison> out;
+    for (auto& m : current.metrics()) {
+        auto old = base.find(m.name);
+        if (!old)
+            continue;
+        Comparison c;
+        c.name = m.name;
+        c.unit = m.unit;
+        c.base_mean = old->mean();
+        c.new_mean = m.mean();
+        c.change = c.base_mean != 0 ? (c.new_mean - c.base_mean) / std::fabs(c.base_mean) : 0;
+        c.p_value = welch_p_value(*old, m);
+        c.significant = !std::isnan(c.p_value) && c.p_value < alpha &&
+                        std::fabs(c.change) >= min_change;
+        bool worse = m.lower_is_better ? c.change > 0 : c.change < 0;
+        c.regression = c.significant && worse;
+        c.improvement = c.significant && !worse;
+        out.push_back(c);
+    }
+    return out;
+}
+
+}  // namespace bench
@@ -0,0 +1,144 @@
+#pragma once
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Binary operation traces for replaying recorded workloads against the trees.
+//
+// A trace starts with the magic "RTRC", a format version byte and the number of dimensions,
+// followed by one record per operation: the kind byte, the payload id (not for searches) and
+// one rectangle, two for updates. Coordinates are integers; every rectangle is stored as the
+// zigzag varint difference of its lower corner to the previous rectangle's lower corner, then
+// its extent as a plain varint, so point data and spatially clustered streams take only a few
+// bytes per coordinate.
+namespace trace {
+
+enum class Kind : uint8_t { insert, remove, update, search };
+
+struct TraceOp {
+    Kind kind;
+    uint64_t id = 0;                          // payload id, unused by searches
+    std::vector<long long> lo, hi;            // the rectangle; for updates the current one
+    std::vector<long long> to_lo{}, to_hi{};  // updates only: where the entry moves to
+};
+
+constexpr char magic[4] = {'R', 'T', 'R', 'C'};
+constexpr uint8_t version = 1;
+
+class TraceWriter {
+   public:
+    TraceWriter(std::ostream& out, int dims) : out(out), prev(dims, 0) {
+        out.write(magic, sizeof(magic));
+        out.put(char(version));
+        out.put(char(dims));
+    }
+
+    void write(const TraceOp& op) {
+        out.put(char(op.kind));
+        if (op.kind != Kind::search)
+            put_varint(op.id);
+        put_rect(op.lo, op.hi);
+        if (op.kind == Kind::update)
+            put_rect(op.to_lo, op.to_hi);
+    }
+
+   private:
+    std::ostream& out;
+    std::vector<long long> prev;
+
+    void put_varint(uint64_t v) {
+        for (; v >= 0x80; v >>= 7) out.put(char(v | 0x80));
+        out.put(char(v));
+    }
+
+    void put_rect(const std::vector<long long>& lo, const std::vector<long long>& hi) {
+        if (lo.size() != prev.size() || hi.size() != prev.size())
+            throw std::invalid_argument("trace rectangle has the wrong number of dimensions");
+        for (size_t i = 0; i < prev.size(); i++) {
+            if (hi[i] < lo[i])
+                throw std::invalid_argument("trace rectangle has hi < lo");
+            auto delta = uint64_t(lo[i]) - uint64_t(prev[i]);
+            put_varint((delta << 1) ^ -(delta >> 63));
+            put_varint(uint64_t(hi[i]) - uint64_t(lo[i]));
+            prev[i] = lo[i];
+        }
+    }
+};
+
+class TraceReader {
+   public:
+    explicit TraceReader(std::istream& in) : in(in) {
+        char header[sizeof(magic)];
+        if (!in.read(header, sizeof(header)) || std::string(header, sizeof(header)) != "RTRC")
+            throw std::runtime_error("not an operation trace");
+        if (get_byte() != version)
+            throw std::runtime_error("unsupported trace version");
+        prev.assign(get_byte(), 0);
+    }
+
+    int dims() const { return int(prev.size()); }
+
+    // Reads the next operation into `op`; false at the end of the trace.
+    bool next(TraceOp& op) {
+        int kind = in.get();
+        if (kind == std::char_traits<char>::eof())
+            return false;
+        if (kind > int(Kind::search))
+            throw std::runtime_error("corrupt trace record");
+        op.kind = Kind(kind);
+        op.id = op.kind == Kind::search ? 0 : get_varint();
+        get_rect(op.lo, op.hi);
+        if (op.kind == Kind::update) {
+            get_rect(op.to_lo, op.to_hi);
+        } else {
+            op.to_lo.clear();
+            op.to_hi.clear();
+        }
+        return true;
+    }
+
+    std::vector<TraceOp> read_all() {
+        std::vector<TraceOp> ops;
+        for (TraceOp op; next(op);) ops.push_back(op);
+        return ops;
+    }
+
+   private:
+    std::istream& in;
+    std::vector<long long> prev;
+
+    uint8_t get_byte() {
+        int c = in.get();
+        if (c == std::char_traits<char>::eof())
+            throw std::runtime_error("truncated trace");
+        return uint8_t(c);
+    }
+
+    uint64_t get_varint() {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t b = get_byte();
+            v |= uint64_t(b & 0x7f) << shift;
+            if (!(b & 0x80))
+                return v;
+        }
+        throw std::runtime_error("corrupt trace varint");
+    }
+
+    void get_rect(std::vector<long long>& lo, std::vector<long long>& hi) {
+        lo.resize(prev.size());
+        hi.resize(prev.size());
+        for (size_t i = 0; i < prev.size(); i++) {
+            uint64_t zigzag = get_varint();
+            uint64_t delta = (zigzag >> 1) ^ -(zigzag & 1);
+            lo[i] = (long long)(uint64_t(prev[i]) + delta);
+            hi[i] = (long long)(uint64_t(lo[i]) + get_varint());
+            prev[i] = lo[i];
+        }
+    }
+};
+
+}  // namespace trace
@@ -1,3 +1,9 @@
+#include <sys/resource.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
 #include <algorithm>
 #include <cassert>
 #include <chrono>
@@ -6,9 +12,14 @@
 #include <iomanip>
 #include <iostream>
 #include <limits>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "benchmark/replay.h"
+#include "benchmark/results.h"
+#include "benchmark/trace.h"
 #include "rtree/rtree.h"
 #include "rtree_hilbert/hilbert_rtree.h"
 // Assuming the Gutman::RTree class is included here
@@ -16,6 +27,9 @@
 
 using Rectangle = Gutman::Rectangle;
 
+// Svi rezultati benchmarka, za --json izlaz
+bench::Results bench_results;
+
 // Helper function to create a rectangle
 Rectangle makeRect(std::vector<double> min, std::vector<double> max) {
     return Rectangle(min, max);
@@ -798,6 +812,7 @@ void run_benchmark(const std::string& dataset_name, const std::string& filename)
         });
         std::cout << "Insert Time: " << std::fixed << std::setprecision(6) << t_insert << " s"
                   << std::endl;
+        bench_results.add(filename + "/Gutman/insert", "s", t_insert);
 
         double t_search = measure_time([&]() {
             std::vector<double> s_min = {static_cast<double>(min_x), static_cast<double>(min_y)};
@@ -808,6 +823,17 @@ void run_benchmark(const std::string& dataset_name, const std::string& filename)
         std::cout << "Search Time: " << std::fixed << std::setprecision(6) << t_search << " s"
                   << std::endl;
         std::cout << "Pronadjeno tacaka: " << gutman_found << " / " << total_points << std::endl;
+        bench_results.add(filename + "/Gutman/search", "s", t_search);
+
+        // Histogrami usporavaju svaku operaciju, pa se latencija meri u posebnom prolazu
+        Gutman::RTree<Payload> measured(min_entries, max_entries);
+        measured.enable_latency_histograms();
+        for (const auto& p : data) {
+            std::vector<double> point = {static_cast<double>(p.x), static_cast<double>(p.y)};
+            measured.insert(Gutman::Rectangle(point, point), new Payload(p.id));
+        }
+        std::cout << "Insert latency: " << measured.latency_histogram(Gutman::Operation::insert)
+                  << std::endl;
     }
 
     // -------------------------------------------------
@@ -826,6 +852,7 @@ void run_benchmark(const std::string& dataset_name, const std::string& filename)
         });
         std::cout << "Insert Time: " << std::fixed << std::setprecision(6) << t_insert << " s"
                   << std::endl;
+        bench_results.add(filename + "/Hilbert/insert", "s", t_insert);
 
         double t_search = measure_time([&]() {
             std::vector<long long> s_min = {min_x, min_y};
@@ -836,6 +863,16 @@ void run_benchmark(const std::string& dataset_name, const std::string& filename)
         std::cout << "Search Time: " << std::fixed << std::setprecision(6) << t_search << " s"
                   << std::endl;
         std::cout << "Pronadjeno tacaka: " << hilbert_found << " / " << total_points << std::endl;
+        bench_results.add(filename + "/Hilbert/search", "s", t_search);
+
+        hilbert::RTree<Payload> measured(min_entries, max_entries, 2, 64);
+        measured.enable_latency_histograms();
+        for (const auto& p : data) {
+            std::vector<long long> point = {p.x, p.y};
+            measured.insert(hilbert::Rectangle(point, point), new Payload(p.id));
+        }
+        std::cout << "Insert latency: " << measured.latency_histogram(hilbert::Operation::insert)
+                  << std::endl;
     }
 
     // -------------------------------------------------
@@ -852,7 +889,9 @@ void run_benchmark(const std::string& dataset_name, const std::string& filename)
             std::cout << "Hilbert fali: " << (total_points - hilbert_found) << std::endl;
     }
 }
-void run_scalability_test(const std::string& filename) {
+
+// Svaki korak se meri `repeats` puta; CSV dobija prosek, a --json sve uzorke
+void run_scalability_test(const std::string& filename, int repeats = 5) {
     std::cout << "\n========================================================" << std::endl;
     std::cout << "GENERISANJE PODATAKA ZA GRAFIKE (SKALABILNOST)" << std::endl;
     std::cout << "========================================================" << std::endl;
@@ -886,10 +925,12 @@ void run_scalability_test(const std::string& filename) {
         double g_insert = 0, h_insert = 0;
         double g_search = 0, h_search = 0;
 
-        // --- GUTMAN MERENJE ---
-        {
+        std::string key = "scalability/N=" + std::to_string(n);
+
+        for (int r = 0; r < repeats; r++) {
+            // --- GUTMAN MERENJE ---
             Gutman::RTree<Payload> tree(4, 8);
-            g_insert = measure_time([&]() {
+            double insert = measure_time([&]() {
                 for (const auto& p : subset) {
                     std::vector<double> p_min = {static_cast<double>(p.x),
                                                  static_cast<double>(p.y)};
@@ -899,19 +940,23 @@ void run_scalability_test(const std::string& filename) {
                 }
             });
 
-            g_search = measure_time([&]() {
+            double search = measure_time([&]() {
                 std::vector<double> s_min = {static_cast<double>(min_x),
                                              static_cast<double>(min_y)};
                 std::vector<double> s_max = {static_cast<double>(max_x),
                                              static_cast<double>(max_y)};
                 auto res = tree.search(Gutman::Rectangle(s_min, s_max));
             });
+            bench_results.add(key + "/Gutman/insert", "s", insert);
+            bench_results.add(key + "/Gutman/search", "s", search);
+            g_insert += insert / repeats;
+            g_search += search / repeats;
         }
 
-        // --- HILBERT MERENJE ---
-        {
+        for (int r = 0; r < repeats; r++) {
+            // --- HILBERT MERENJE ---
             hilbert::RTree<Payload> tree(4, 8, 2, 64);
-            h_insert = measure_time([&]() {
+            double insert = measure_time([&]() {
                 for (const auto& p : subset) {
                     std::vector<long long> p_min = {p.x, p.y};
                     std::vector<long long> p_max = {p.x, p.y};
@@ -919,11 +964,15 @@ void run_scalability_test(const std::string& filename) {
                 }
             });
 
-            h_search = measure_time([&]() {
+            double search = measure_time([&]() {
                 std::vector<long long> s_min = {min_x, min_y};
                 std::vector<long long> s_max = {max_x, max_y};
                 auto res = tree.search(hilbert::Rectangle(s_min, s_max));
             });
+            bench_results.add(key + "/Hilbert/insert", "s", insert);
+            bench_results.add(key + "/Hilbert/search", "s", search);
+            h_insert += insert / repeats;
+            h_search += search / repeats;
         }
 
         // Ispis na ekran da vidis da radi
@@ -937,12 +986,273 @@ void run_scalability_test(const std::string& filename) {
 
     std::cout << "\n[INFO] Rezultati sacuvani u 'benchmark_results.csv'" << std::endl;
 }
-int main() {
+
+// Trenutni RSS procesa u KB (iz /proc/self/statm), 0 ako nije dostupan. Sa glibc prvo vraca
+// oslobodjenu memoriju sistemu da se merenja stabala ne bi preklapala.
+long current_rss_kb() {
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+    std::ifstream statm("/proc/self/statm");
+    long pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Najveci RSS procesa do sada u KB
+long peak_rss_kb() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Memorija po unosu za oba stabla, za vise velicina dataseta i kapaciteta cvora
+void run_memory_test(const std::string& filename) {
+    std::cout << "\n========================================================" << std::endl;
+    std::cout << "MEMORIJA PO UNOSU" << std::endl;
+    std::cout << "========================================================" << std::endl;
+
+    auto full_data = load_dataset(filename);
+    if (full_data.empty())
+        return;
+    std::vector<Payload> payloads;
+    for (const auto& p : full_data) payloads.push_back(p.id);
+
+    std::vector<size_t> steps = {1000, 5000, 10000, 20000, full_data.size()};
+    std::vector<int> capacities = {8, 16, 32};
+
+    std::ofstream csv_file("memory_results.csv");
+    csv_file << "N,Engine,M,Bytes,BytesPerEntry,RssDeltaKB,PeakRssKB\n";
+    std::cout << "N\tEngine\tM\tBytes\tB/entry\tRSS+KB\tPeakKB" << std::endl;
+
+    auto report = [&](size_t n, const char* engine, int M, const auto& usage, long rss_before) {
+        long rss_delta = current_rss_kb() - rss_before;
+        std::cout << n << "\t" << engine << "\t" << M << "\t" << usage.total() << "\t"
+                  << std::fixed << std::setprecision(1) << usage.bytes_per_entry() << "\t"
+                  << rss_delta << "\t" << peak_rss_kb() << std::endl;
+        csv_file << n << "," << engine << "," << M << "," << usage.total() << ","
+                 << usage.bytes_per_entry() << "," << rss_delta << "," << peak_rss_kb() << "\n";
+        std::string key =
+            "memory/N=" + std::to_string(n) + "/" + engine + "/M=" + std::to_string(M);
+        bench_results.add(key + "/bytes_per_entry", "B", usage.bytes_per_entry());
+        bench_results.add(key + "/rss_delta", "KB", rss_delta);
+    };
+
+    for (size_t n : steps) {
+        n = std::min(n, full_data.size());
+        for (int M : capacities) {
+            {
+                long rss_before = current_rss_kb();
+                Gutman::RTree<Payload> tree(M / 2, M);
+                for (size_t i = 0; i < n; i++) {
+                    std::vector<double> p = {static_cast<double>(full_data[i].x),
+                                             static_cast<double>(full_data[i].y)};
+                    tree.insert(Gutman::Rectangle(p, p), &payloads[i]);
+                }
+                report(n, "Gutman", M, tree.memory_usage(), rss_before);
+            }
+            {
+                long rss_before = current_rss_kb();
+                hilbert::RTree<Payload> tree(M / 2, M, 2, 64);
+                for (size_t i = 0; i < n; i++) {
+                    std::vector<long long> p = {full_data[i].x, full_data[i].y};
+                    tree.insert(hilbert::Rectangle(p, p), &payloads[i]);
+                }
+                report(n, "Hilbert", M, tree.memory_usage(), rss_before);
+            }
+        }
+    }
+
+    std::cout << "\n[INFO] Rezultati sacuvani u 'memory_results.csv'" << std::endl;
+}
+// Snima trace od dataseta: ubaci sve tacke, pa za svaku tacku pretraga prozora oko nje,
+// svaka deseta se pomera, svaka dvadeseta brise
+void record_trace(const std::string& dataset, const std::string& out_file) {
+    auto data = load_dataset(dataset);
+    if (data.empty())
+        return;
+    long long min_x, min_y, max_x, max_y;
+    get_dataset_bounds(data, min_x, min_y, max_x, max_y);
+    long long side = std::max(1LL, std::max(max_x - min_x, max_y - min_y) / 100);
+
+    std::ofstream file(out_file, std::ios::binary);
+    trace::TraceWriter writer(file, 2);
+    for (size_t i = 0; i < data.size(); i++) {
+        writer.write({trace::Kind::insert, i, {data[i].x, data[i].y}, {data[i].x, data[i].y}});
+    }
+    for (size_t i = 0; i < data.size(); i++) {
+        auto& p = data[i];
+        writer.write({trace::Kind::search, 0, {p.x - side, p.y - side}, {p.x + side, p.y + side}});
+        if (i % 10 == 0) {
+            writer.write({trace::Kind::update, i, {p.x, p.y}, {p.x, p.y}, {p.x + 1, p.y},
+                          {p.x + 1, p.y}});
+        } else if (i % 20 == 5) {
+            writer.write({trace::Kind::remove, i, {p.x, p.y}, {p.x, p.y}});
+        }
+    }
+    std::cout << "Trace snimljen u " << out_file << " (" << file.tellp() << " B)" << std::endl;
+}
+
+void print_replay(const std::string& name, const trace::ReplayResult& r) {
+    std::cout << name << " threads=" << r.threads << " ops=" << r.ops << " time=" << std::fixed
+              << std::setprecision(6) << r.seconds << " s throughput=" << std::setprecision(0)
+              << r.throughput() << " ops/s" << std::endl;
+    for (size_t op = 0; op < Gutman::operation_count; op++) {
+        if (r.latency[op].count() > 0)
+            std::cout << "  " << Gutman::operation_name(Gutman::Operation(op)) << ": "
+                      << r.latency[op] << std::endl;
+    }
+}
+
+// Pusta snimljeni trace na oba stabla za svaki zadati broj niti
+void run_replay(const std::string& trace_file, std::vector<unsigned> thread_counts) {
+    std::ifstream file(trace_file, std::ios::binary);
+    trace::TraceReader reader(file);
+    int dims = reader.dims();
+    auto ops = reader.read_all();
+    if (thread_counts.empty())
+        thread_counts = {1, std::max(1u, std::thread::hardware_concurrency())};
+
+    std::cout << "\n========================================================" << std::endl;
+    std::cout << "REPLAY: " << trace_file << " (" << ops.size() << " operacija)" << std::endl;
+    std::cout << "========================================================" << std::endl;
+    for (unsigned threads : thread_counts) {
+        {
+            Gutman::RTree<uint64_t> tree(4, 8);
+            auto result = trace::replay(tree, ops, threads, [](const auto& lo, const auto& hi) {
+                return Gutman::Rectangle(std::vector<double>(lo.begin(), lo.end()),
+                                         std::vector<double>(hi.begin(), hi.end()));
+            });
+            print_replay("Gutman", result);
+            bench_results.add("replay/threads=" + std::to_string(threads) + "/Gutman", "ops/s",
+                              result.throughput(), false);
+        }
+        {
+            hilbert::RTree<uint64_t> tree(4, 8, dims, 62 / dims);
+            auto result = trace::replay(tree, ops, threads, [](const auto& lo, const auto& hi) {
+                return hilbert::Rectangle(lo, hi);
+            });
+            print_replay("Hilbert", result);
+            bench_results.add("replay/threads=" + std::to_string(threads) + "/Hilbert", "ops/s",
+                              result.throughput(), false);
+        }
+    }
+}
+
+// Poredi dva JSON fajla sa rezultatima; vraca 1 ako postoji statisticki znacajna regresija
+int run_compare(const std::string& base_file, const std::string& new_file, double alpha) {
+    std::ifstream base_in(base_file), new_in(new_file);
+    if (!base_in || !new_in) {
+        std::cerr << "GRESKA: Ne mogu da otvorim " << (base_in ? new_file : base_file) << std::endl;
+        return 2;
+    }
+    auto base = bench::Results::read_json(base_in);
+    auto current = bench::Results::read_json(new_in);
+    for (auto key : {"compiler", "cores", "machine"}) {
+        if (base.environment[key] != current.environment[key])
+            std::cout << "[WARN] " << key << ": " << base.environment[key] << " -> "
+                      << current.environment[key] << std::endl;
+    }
+
+    int regressions = 0;
+    std::cout << std::left << std::setw(48) << "metric" << std::right << std::setw(14) << "base"
+              << std::setw(14) << "new" << std::setw(9) << "change" << std::setw(10) << "p"
+              << std::endl;
+    for (auto& c : bench::compare(base, current, alpha)) {
+        regressions += c.regression;
+        std::cout << std::left << std::setw(48) << c.name << std::right << std::setw(14)
+                  << std::setprecision(6) << std::defaultfloat << c.base_mean << std::setw(14)
+                  << c.new_mean << std::setw(8) << std::fixed << std::setprecision(1)
+                  << c.change * 100 << "%" << std::setw(10) << std::setprecision(4) << c.p_value
+                  << (c.regression ? "  REGRESSION" : c.improvement ? "  improved" : "")
+                  << std::endl;
+    }
+    std::cout << "\nRegresija: " << regressions << " (alpha=" << alpha << ")" << std::endl;
+    return regressions > 0 ? 1 : 0;
+}
+
+int usage(const char* program) {
+    std::cerr << "Upotreba:\n"
+              << "  " << program << " [--json fajl] [--repeats k]\n"
+              << "  " << program << " [--json fajl] [--repeats k] --record-trace dataset trace\n"
+              << "  " << program << " [--json fajl] [--repeats k] --replay trace [niti...]\n"
+              << "  " << program << " [--json fajl] [--repeats k] --memory dataset\n"
+              << "  " << program << " --compare base.json new.json [alpha]" << std::endl;
+    return 2;
+}
+
+// Broj iz argumenta komandne linije; false ako ceo string nije broj
+template <typename Number>
+bool parse_number(const std::string& text, Number& out) {
+    std::istringstream in(text);
+    return in >> out && in.peek() == EOF;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+    if (!args.empty() && args[0] == "--compare") {
+        double alpha = 0.05;
+        if (args.size() < 3 || args.size() > 4 ||
+            (args.size() == 4 && !parse_number(args[3], alpha)))
+            return usage(argv[0]);
+        return run_compare(args[1], args[2], alpha);
+    }
+
+    // --json <fajl> i --repeats <k> mogu da stoje ispred bilo kog moda
+    std::string json_file;
+    int repeats = 5;
+    while (!args.empty() && (args[0] == "--json" || args[0] == "--repeats")) {
+        if (args.size() < 2)
+            return usage(argv[0]);
+        if (args[0] == "--json")
+            json_file = args[1];
+        else if (!parse_number(args[1], repeats))
+            return usage(argv[0]);
+        repeats = std::max(1, repeats);
+        args.erase(args.begin(), args.begin() + 2);
+    }
+    std::vector<unsigned> thread_counts;
+    bool known = args.empty() || (args[0] == "--record-trace" && args.size() == 3) ||
+                 (args[0] == "--replay" && args.size() >= 2) ||
+                 (args[0] == "--memory" && args.size() == 2);
+    for (size_t i = 2; known && args[0] == "--replay" && i < args.size(); i++) {
+        long threads = 0;
+        known = parse_number(args[i], threads) && threads > 0 && threads <= 4096;
+        thread_counts.push_back(unsigned(threads));
+    }
+    if (!known)
+        return usage(argv[0]);
+    bench_results.config["repeats"] = std::to_string(repeats);
+    bench_results.config["mode"] = args.empty() ? "default" : args[0];
+    auto finish = [&](int status) {
+        if (!json_file.empty()) {
+            std::ofstream out(json_file);
+            bench_results.write_json(out);
+            std::cout << "[INFO] JSON rezultati sacuvani u '" << json_file << "'" << std::endl;
+        }
+        return status;
+    };
+
+    if (!args.empty() && args[0] == "--record-trace") {
+        record_trace(args[1], args[2]);
+        return finish(0);
+    }
+    if (!args.empty() && args[0] == "--replay") {
+        bench_results.config["trace"] = args[1];
+        run_replay(args[1], thread_counts);
+        return finish(0);
+    }
+    if (!args.empty() && args[0] == "--memory") {
+        bench_results.config["dataset"] = args[1];
+        run_memory_test(args[1]);
+        return finish(0);
+    }
+
     RTreeTest test_suite;
     test_suite.run_all_tests();
     run_benchmark("1000 Points Dataset", "1000.txt");
     run_benchmark("Greek Earthquakes (1964-2000)", "greek-earthquakes-1964-2000.txt");
-    run_scalability_test("greek-earthquakes-1964-2000.txt");
+    run_scalability_test("greek-earthquakes-1964-2000.txt", repeats);
     std::cout << "\nBenchmark zavrsen." << std::endl;
-    return 0;
+    return finish(0);
 }
\ No newline at end of file
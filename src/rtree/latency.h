@@ -0,0 +1,203 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace Gutman {
+
+enum class Operation { insert, remove, update, search, knn };
+constexpr size_t operation_count = 5;
+
+inline const char* operation_name(Operation op) {
+    static const char* names[operation_count] = {"insert", "remove", "update", "search", "knn"};
+    return names[size_t(op)];
+}
+
+// Log-linear latency buckets in nanoseconds, HDR style: values below 32 ns get a bucket each,
+// above that every power of two is split into 16 equal sub-buckets, so a bucket is never wider
+// than 1/16 of its lower bound. Values of 2^40 ns (about 18 minutes) and more share the top
+// bucket.
+struct LatencyBuckets {
+    static constexpr int sub_bits = 4;
+    static constexpr uint64_t sub_count = uint64_t(1) << sub_bits;
+    static constexpr int max_bits = 40;
+    static constexpr size_t count = (max_bits - sub_bits + 1) * sub_count;
+
+    static size_t index(uint64_t ns) {
+        if (ns >= (uint64_t(1) << max_bits))
+            return count - 1;
+        if (ns < 2 * sub_count)
+            return ns;
+        int shift = 63 - __builtin_clzll(ns) - sub_bits;
+        return (shift + 1) * sub_count + (ns >> shift) - sub_count;
+    }
+
+    static uint64_t lower(size_t i) {
+        if (i < 2 * sub_count)
+            return i;
+        int shift = int(i / sub_count) - 1;
+        return (i % sub_count + sub_count) << shift;
+    }
+
+    static uint64_t upper(size_t i) { return i + 1 < count ? lower(i + 1) - 1 : UINT64_MAX; }
+};
+
+// A merged, point-in-time copy of one operation's histogram.
+class LatencySnapshot {
+   public:
+    struct Bucket {
+        uint64_t lower_ns, upper_ns, count;
+    };
+
+    LatencySnapshot() : counts(LatencyBuckets::count, 0) {}
+
+    uint64_t count() const { return total; }
+    uint64_t max() const { return max_ns; }
+    double mean() const { return total ? double(sum_ns) / total : 0; }
+
+    // Upper bound of the bucket holding the q-th quantile (q in [0, 1]), capped at the largest
+    // value seen; 0 when nothing was recorded.
+    uint64_t percentile(double q) const {
+        if (total == 0)
+            return 0;
+        uint64_t rank = std::max<uint64_t>(1, uint64_t(q * total + 0.5));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); i++) {
+            seen += counts[i];
+            if (seen >= rank)
+                return std::min(LatencyBuckets::upper(i), max_ns);
+        }
+        return max_ns;
+    }
+
+    // The non-empty buckets in increasing order, for export.
+    std::vector<Bucket> buckets() const {
+        std::vector<Bucket> result;
+        for (size_t i = 0; i < counts.size(); i++) {
+            if (counts[i])
+                result.push_back({LatencyBuckets::lower(i), LatencyBuckets::upper(i), counts[i]});
+        }
+        return result;
+    }
+
+    void merge(const LatencySnapshot& other) {
+        for (size_t i = 0; i < counts.size(); i++) counts[i] += other.counts[i];
+        total += other.total;
+        sum_ns += other.sum_ns;
+        max_ns = std::max(max_ns, other.max_ns);
+    }
+
+    friend std::ostream& operator<<(std::ostream& out, const LatencySnapshot& s) {
+        return out << "n=" << s.count() << " mean=" << s.mean() << "ns p50=" << s.percentile(0.5)
+                   << "ns p90=" << s.percentile(0.9) << "ns p99=" << s.percentile(0.99)
+                   << "ns p99.9=" << s.percentile(0.999) << "ns max=" << s.max() << "ns";
+    }
+
+   private:
+    friend class LatencyRecorder;
+
+    std::vector<uint64_t> counts;
+    uint64_t total = 0, sum_ns = 0, max_ns = 0;
+};
+
+// Per-tree latency histograms for every Operation. Each thread records into its own shard with
+// relaxed atomic increments, so recording never takes a lock; snapshot() merges the shards.
+class LatencyRecorder {
+   public:
+    // Times one operation from construction to destruction. Does nothing when given no
+    // recorder, and operations started while another one of the same recorder is running on
+    // this thread (a remove() reinserting orphans, say) are counted only as part of the outer
+    // one.
+    class Scope {
+       public:
+        Scope(LatencyRecorder* recorder, Operation op) : op(op) {
+            if (recorder && active != recorder) {
+                owner = recorder;
+                outer = active;
+                active = recorder;
+                start = std::chrono::steady_clock::now();
+            }
+        }
+
+        ~Scope() {
+            if (!owner)
+                return;
+            owner->record(op, std::chrono::steady_clock::now() - start);
+            active = outer;
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+       private:
+        static inline thread_local const LatencyRecorder* active = nullptr;
+
+        LatencyRecorder* owner = nullptr;
+        const LatencyRecorder* outer = nullptr;
+        Operation op;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    void record(Operation op, std::chrono::nanoseconds elapsed) {
+        uint64_t ns = std::max<int64_t>(0, elapsed.count());
+        auto& h = shards[shard_index()].ops[size_t(op)];
+        h.counts[LatencyBuckets::index(ns)].fetch_add(1, std::memory_order_relaxed);
+        h.total.fetch_add(1, std::memory_order_relaxed);
+        h.sum_ns.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t seen = h.max_ns.load(std::memory_order_relaxed);
+        while (ns > seen && !h.max_ns.compare_exchange_weak(seen, ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    LatencySnapshot snapshot(Operation op) const {
+        LatencySnapshot s;
+        for (auto& shard : shards) {
+            auto& h = shard.ops[size_t(op)];
+            for (size_t i = 0; i < LatencyBuckets::count; i++)
+                s.counts[i] += h.counts[i].load(std::memory_order_relaxed);
+            s.total += h.total.load(std::memory_order_relaxed);
+            s.sum_ns += h.sum_ns.load(std::memory_order_relaxed);
+            s.max_ns = std::max(s.max_ns, h.max_ns.load(std::memory_order_relaxed));
+        }
+        return s;
+    }
+
+    void reset() {
+        for (auto& shard : shards) {
+            for (auto& h : shard.ops) {
+                for (auto& c : h.counts) c.store(0, std::memory_order_relaxed);
+                h.total.store(0, std::memory_order_relaxed);
+                h.sum_ns.store(0, std::memory_order_relaxed);
+                h.max_ns.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+   private:
+    static constexpr size_t shard_count = 8;
+
+    struct Histogram {
+        std::array<std::atomic<uint64_t>, LatencyBuckets::count> counts{};
+        std::atomic<uint64_t> total{0}, sum_ns{0}, max_ns{0};
+    };
+
+    struct alignas(64) Shard {
+        std::array<Histogram, operation_count> ops;
+    };
+
+    std::array<Shard, shard_count> shards;
+
+    // Threads take shards round-robin in the order they first record.
+    static size_t shard_index() {
+        static std::atomic<size_t> next{0};
+        thread_local size_t index = next.fetch_add(1, std::memory_order_relaxed) % shard_count;
+        return index;
+    }
+};
+
+}  // namespace Gutman
@@ -6,6 +6,9 @@
 
 #include <algorithm>
 #include <any>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <functional>
 #include <initializer_list>
 #include <iostream>
@@ -13,15 +16,27 @@
 #include <limits>
 #include <memory>
 #include <queue>
+#include <random>
+#include <set>
 #include <stack>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include "rtree/latency.h"
+#include "rtree_hilbert/hilbert_curve.h"
+
 namespace Gutman {
 
 static int optimization_counter = 0;
+
+using Timestamp = long long;
+constexpr Timestamp never_expires = std::numeric_limits<Timestamp>::max();
+
 inline bool equal(double x, double y, double eps = 1e-7) {
 
     return std::fabs(x - y) <= eps * (std::fabs(x) + std::fabs(y));
@@ -56,6 +71,15 @@ struct Rectangle {
         return flag;
     }
 
+    // Closed test, so points on the boundary count as inside.
+    [[nodiscard]] bool contains_point(const std::vector<double>& p) const {
+        for (int i = 0; i < min.size(); i++) {
+            if (p[i] < min[i] || max[i] < p[i])
+                return false;
+        }
+        return true;
+    }
+
     template <typename Itr>
     static Rectangle calc_mbr(Itr p, Itr q) {
         if (q == p)
@@ -110,18 +134,161 @@ struct Rectangle {
     }
 };
 
+// Heap footprint of a tree, as reported by RTree::memory_usage(). Allocator overhead follows
+// glibc malloc: a block costs its size plus an 8 byte header, rounded up to 16 and at least 32.
+struct MemoryUsage {
+    size_t nodes = 0;       // node objects
+    size_t entries = 0;     // leaf records
+    size_t rectangles = 0;  // coordinate storage of node and entry rectangles
+    size_t containers = 0;  // child and entry containers, including spare capacity
+    size_t allocator_overhead = 0;
+    size_t entry_count = 0;
+
+    [[nodiscard]] size_t total() const {
+        return nodes + entries + rectangles + containers + allocator_overhead;
+    }
+
+    [[nodiscard]] double bytes_per_entry() const {
+        return entry_count ? double(total()) / entry_count : 0;
+    }
+
+    // Accounts for one heap block of `bytes` and returns `bytes`; empty blocks are never
+    // allocated and cost nothing.
+    size_t heap(size_t bytes) {
+        if (bytes > 0)
+            allocator_overhead += std::max<size_t>(32, (bytes + 8 + 15) & ~size_t(15)) - bytes;
+        return bytes;
+    }
+
+    friend std::ostream& operator<<(std::ostream& out, const MemoryUsage& usage) {
+        return out << "total=" << usage.total() << " B (nodes=" << usage.nodes
+                   << " entries=" << usage.entries << " rectangles=" << usage.rectangles
+                   << " containers=" << usage.containers
+                   << " allocator=" << usage.allocator_overhead
+                   << ") per entry=" << usage.bytes_per_entry() << " B";
+    }
+};
+
+// Cost breakdown of one query, as reported by RTree::explain() and RTree::explain_nearest().
+struct QueryStats {
+    std::vector<size_t> nodes_per_level;  // nodes visited, root level first
+    size_t mbr_tests = 0;                 // node MBR and entry rectangle tests
+    size_t false_positive_leaves = 0;     // leaves visited that contributed nothing
+    size_t entries_scanned = 0;
+    size_t entries_returned = 0;
+    std::chrono::nanoseconds elapsed{0};
+
+    [[nodiscard]] size_t nodes_visited() const {
+        size_t n = 0;
+        for (auto level : nodes_per_level) n += level;
+        return n;
+    }
+
+    void visit_node(size_t level) {
+        if (nodes_per_level.size() <= level)
+            nodes_per_level.resize(level + 1);
+        nodes_per_level[level]++;
+    }
+
+    friend std::ostream& operator<<(std::ostream& out, const QueryStats& stats) {
+        out << "nodes per level:";
+        for (auto level : stats.nodes_per_level) out << " " << level;
+        out << "\nMBR tests: " << stats.mbr_tests
+            << "\nfalse positive leaves: " << stats.false_positive_leaves
+            << "\nentries scanned/returned: " << stats.entries_scanned << "/"
+            << stats.entries_returned << "\nelapsed: " << stats.elapsed.count() / 1000.0 << " us\n";
+        return out;
+    }
+};
+
+// Where a paged search stopped, as returned by search_page() and passed back for the next page.
+// The position is the tree's own: the child index taken at every level down to the last entry
+// returned for Gutman::RTree, the last Hilbert key and insertion number returned for
+// hilbert::RTree. A default token starts at the beginning. str() and parse() give a short text
+// form ("" to start, "end" when done, else the position joined by dots).
+struct PageToken {
+    std::vector<long long> position;
+    bool done = false;
+
+    [[nodiscard]] std::string str() const {
+        if (done)
+            return "end";
+        std::string out;
+        for (auto p : position) out += (out.empty() ? "" : ".") + std::to_string(p);
+        return out;
+    }
+
+    static PageToken parse(const std::string& text) {
+        PageToken token;
+        if (text == "end") {
+            token.done = true;
+            return token;
+        }
+        size_t at = 0;
+        while (at < text.size()) {
+            size_t dot = std::min(text.find('.', at), text.size());
+            size_t used = 0;
+            try {
+                token.position.push_back(std::stoll(text.substr(at, dot - at), &used));
+            } catch (const std::exception&) {
+                used = 0;
+            }
+            if (used == 0 || used != dot - at)
+                throw std::invalid_argument("Malformed page token: " + text);
+            at = dot + 1;
+        }
+        return token;
+    }
+
+    bool operator==(const PageToken& other) const {
+        return position == other.position && done == other.done;
+    }
+};
+
+// One page of a paged search and the token for the page after it.
+template <typename T>
+struct Page {
+    std::vector<T*> items;
+    PageToken next;
+};
+
+// Leaf record: the payload and its rectangle, plus an optional expiry time.
+template <typename T>
+struct LeafEntry : std::pair<T*, Rectangle> {
+    Timestamp expires_at;
+    double score = 0;  // set from the tree's scorer, see RTree::enable_scores()
+
+    LeafEntry(T* elem, Rectangle mbr, Timestamp expires_at = never_expires)
+        : std::pair<T*, Rectangle>(elem, std::move(mbr)), expires_at(expires_at) {}
+};
+
 template <typename T>
 struct Node {
     static int live_nodes;
     bool is_leaf;
     Node* parent;
     std::vector<Node*> children;
-    std::vector<std::pair<T*, Rectangle>> elems;
+    std::vector<LeafEntry<T>> elems;
     Rectangle mbr;
+    Timestamp min_expiry = never_expires;  // earliest expiry anywhere below this node
+    size_t subtree_count = 0;              // number of leaf entries below this node
+    double max_score = -std::numeric_limits<double>::infinity();  // best score below this node
+
+    // With order_axis >= 0 the entries are kept sorted by their lower edge on that axis and
+    // blocks holds the MBR of every block_size consecutive entries, see RTree::order_nodes().
+    static constexpr int block_size = 16;
+    int order_axis = -1;
+    std::vector<Rectangle> blocks;
+    size_t ordered_count = 0;  // count() when blocks was built
 
     [[nodiscard]] int count() const { return is_leaf ? elems.size() : children.size(); }
 
-    Node(bool is_leaf, Rectangle mbr) : is_leaf(is_leaf), mbr(std::move(mbr)), parent(nullptr) {
+    [[nodiscard]] const Rectangle& rect(size_t i) const {
+        return is_leaf ? elems[i].second : children[i]->mbr;
+    }
+
+    Node(bool is_leaf, Rectangle mbr, int order_axis = -1)
+        : is_leaf(is_leaf), mbr(std::move(mbr)), parent(nullptr), order_axis(order_axis) {
         live_nodes++;
     }
     ~Node() {
@@ -129,17 +296,91 @@ struct Node {
         for (auto child : children) delete child;
     }
 
+    // Calls f(i) for every entry whose rectangle overlaps s and returns the number of entries
+    // tested; block tests are added to *block_tests. An ordered node stops at the first entry
+    // starting past s on the order axis and skips blocks whose MBR misses s; any other node
+    // tests every entry.
+    template <typename F>
+    size_t scan(const Rectangle& s, F&& f, size_t* block_tests = nullptr) const {
+        size_t n = count(), end = n, tests = 0;
+        if (order_axis < 0 || ordered_count != n) {
+            for (size_t i = 0; i < n; i++)
+                if (Rectangle::overlap(rect(i), s))
+                    f(i);
+            return n;
+        }
+        double limit = s.max[order_axis];
+        size_t lo = 0;
+        while (lo < end) {
+            size_t mid = (lo + end) / 2;
+            if (rect(mid).min[order_axis] <= limit)
+                lo = mid + 1;
+            else
+                end = mid;
+        }
+        for (size_t b = 0; b * block_size < end; b++) {
+            if (block_tests)
+                ++*block_tests;
+            if (!Rectangle::overlap(blocks[b], s))
+                continue;
+            for (size_t i = b * block_size; i < std::min(end, (b + 1) * block_size); i++) {
+                tests++;
+                if (Rectangle::overlap(rect(i), s))
+                    f(i);
+            }
+        }
+        return tests;
+    }
+
+    // Sorts the entries along order_axis and rebuilds the block MBRs.
+    void order_entries() {
+        blocks.clear();
+        ordered_count = count();
+        if (order_axis < 0)
+            return;
+        int axis = order_axis;
+        if (is_leaf) {
+            auto before = [axis](const LeafEntry<T>& a, const LeafEntry<T>& b) {
+                return a.second.min[axis] < b.second.min[axis];
+            };
+            if (!std::is_sorted(elems.begin(), elems.end(), before))
+                std::stable_sort(elems.begin(), elems.end(), before);
+        } else {
+            auto before = [axis](const Node* a, const Node* b) {
+                return a->mbr.min[axis] < b->mbr.min[axis];
+            };
+            if (!std::is_sorted(children.begin(), children.end(), before))
+                std::stable_sort(children.begin(), children.end(), before);
+        }
+        for (size_t i = 0; i < size_t(count()); i++) {
+            if (i % block_size == 0)
+                blocks.push_back(rect(i));
+            else
+                blocks.back() = Rectangle::calc_mbr(blocks.back(), rect(i));
+        }
+    }
+
     void update_mbr() {
+        order_entries();
+        subtree_count = is_leaf ? elems.size() : 0;
+        max_score = -std::numeric_limits<double>::infinity();
         if (is_leaf && elems.size()) {
             auto mbr = elems[0].second;
+            min_expiry = never_expires;
             for (auto& entry : elems) {
                 mbr = Rectangle::calc_mbr(mbr, entry.second);
+                min_expiry = std::min(min_expiry, entry.expires_at);
+                max_score = std::max(max_score, entry.score);
             }
             this->mbr = mbr;
-        } else if (is_leaf && children.size()) {
+        } else if (!is_leaf && children.size()) {
             auto mbr = children[0]->mbr;
+            min_expiry = never_expires;
             for (auto node : children) {
                 mbr = Rectangle::calc_mbr(mbr, node->mbr);
+                min_expiry = std::min(min_expiry, node->min_expiry);
+                subtree_count += node->subtree_count;
+                max_score = std::max(max_score, node->max_score);
             }
             this->mbr = mbr;
         }
@@ -149,24 +390,113 @@ template <typename T>
 int Node<T>::live_nodes = 0;
 template <typename T>
 class RTree {
+    template <typename>
+    friend class RTree;
+
     int m, M;
     Node<T>* root;
     size_t size;
+    std::function<double(const T&)> scorer;
+    std::unique_ptr<LatencyRecorder> latency;
+    int order_axis = -1;
 
    public:
     RTree(int m, int M) : root(nullptr), m(m), M(M), size(0) {}
     ~RTree() { delete root; }
 
     std::vector<T*> search(const Rectangle& search_rect) const {
+        LatencyRecorder::Scope timer(latency.get(), Operation::search);
         std::vector<T*> result;
         _impl_search(search_rect, result, root);
         return result;
     }
 
-    void insert(const Rectangle& mbr, T* elem) {
+    // Same as search(), but leaves out entries that have expired by `now`.
+    std::vector<T*> search(const Rectangle& search_rect, Timestamp now) const {
+        LatencyRecorder::Scope timer(latency.get(), Operation::search);
+        std::vector<T*> result;
+        _impl_search(search_rect, result, root, now);
+        return result;
+    }
+
+    // Same as search(), filling in `stats` along the way.
+    std::vector<T*> search(const Rectangle& search_rect, QueryStats& stats) const {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<T*> result;
+        if (root)
+            _explain_search(root, search_rect, 0, result, stats);
+        stats.entries_returned = result.size();
+        stats.elapsed = std::chrono::steady_clock::now() - start;
+        return result;
+    }
+
+    // Runs search(rect) and reports what it cost: nodes visited per level, rectangle tests,
+    // leaves visited without a match, entries scanned versus returned and elapsed time.
+    QueryStats explain(const Rectangle& search_rect) const {
+        QueryStats stats;
+        search(search_rect, stats);
+        return stats;
+    }
+
+    // Calls visit(elem, rect) for every entry overlapping search_rect.
+    template <typename Visitor>
+    void visit(const Rectangle& search_rect, Visitor&& visit) const {
+        if (root)
+            _visit(root, search_rect, visit);
+    }
+
+    // Up to `limit` entries overlapping search_rect, continuing after `token`. The token holds
+    // the path to the last entry returned, so a page costs a descent plus the page itself
+    // rather than re-running the search. Pages see the tree as it is when they are read: a
+    // token is only exact while the tree is not modified between pages.
+    Page<T> search_page(const Rectangle& search_rect, size_t limit,
+                        const PageToken& token = {}) const {
+        if (limit == 0)
+            throw std::invalid_argument("Page limit must be positive");
+        Page<T> page;
+        page.next.done = true;
+        if (token.done || !root)
+            return page;
+        std::vector<long long> path;
+        if (_page(root, search_rect, limit, token.position, 0, !token.position.empty(), path,
+                  page.items))
+            page.next = PageToken{path};
+        return page;
+    }
+
+    // Stabbing query: calls visit(elem, rect) for every entry whose rectangle contains `point`.
+    template <typename Visitor>
+    void containing(const std::vector<double>& point, Visitor&& visit) const {
+        if (root)
+            _containing(root, point, visit);
+    }
+
+    std::vector<T*> containing(const std::vector<double>& point) const {
+        std::vector<T*> result;
+        containing(point, [&](T* elem, const Rectangle&) { result.push_back(elem); });
+        return result;
+    }
+
+    // Matches a whole batch of points in a single traversal, calling visit(i, elem, rect) for
+    // every entry containing points[i]. The batch is ordered along a Hilbert curve first, so
+    // nearby points share the same descent; the subset of points reaching a node is narrowed
+    // child by child instead of restarting from the root for each point.
+    template <typename Visitor>
+    void containing_batch(const std::vector<std::vector<double>>& points, Visitor&& visit) const {
+        if (!root || points.empty())
+            return;
+        size_t height = 1;
+        for (auto n = root; !n->is_leaf; n = n->children.front()) height++;
+        std::vector<std::vector<size_t>> scratch(height);
+        _containing_batch(root, hilbert_order(points), 0, points, scratch, visit);
+    }
+
+    void insert(const Rectangle& mbr, T* elem, Timestamp expires_at = never_expires) {
+        LatencyRecorder::Scope timer(latency.get(), Operation::insert);
         if (!root) {
-            root = new Node<T>(true, mbr);
-            root->elems.push_back({elem, mbr});
+            root = new Node<T>(true, mbr, order_axis);
+            root->elems.push_back(make_entry(elem, mbr, expires_at));
+            root->update_mbr();
             size++;
             return;
         }
@@ -174,10 +504,10 @@ class RTree {
         Node<T>* ll = nullptr;
 
         if (leaf->count() < M) {
-            leaf->elems.push_back({elem, mbr});
+            leaf->elems.push_back(make_entry(elem, mbr, expires_at));
         } else {
             // invoke split to get L and LL containing current entry E and all previous leaf entries
-            leaf->elems.push_back({elem, mbr});
+            leaf->elems.push_back(make_entry(elem, mbr, expires_at));
             ll = split(leaf);
         }
 
@@ -187,6 +517,7 @@ class RTree {
     }
 
     void remove(const Rectangle& r) {
+        LatencyRecorder::Scope timer(latency.get(), Operation::remove);
         if (!root)
             return;
 
@@ -229,11 +560,378 @@ class RTree {
         }
     }
 
+    // Moves the entry stored under `current` to `desired`, keeping its expiry.
     void update(const Rectangle& current, Rectangle& desired, T* new_elem) {
+        LatencyRecorder::Scope timer(latency.get(), Operation::update);
+        Timestamp expires_at = never_expires;
+        if (Node<T>* leaf = root ? find_leaf(current, root) : nullptr) {
+            for (auto& entry : leaf->elems) {
+                if (Rectangle::equal(entry.second, current)) {
+                    expires_at = entry.expires_at;
+                    break;
+                }
+            }
+        }
         remove(current);
-        insert(desired, new_elem);
+        insert(desired, new_elem, expires_at);
+    }
+
+    // Removes every entry overlapping `window` for which pred(elem, rect) holds.
+    // The affected region is walked once; nodes left underfull are dissolved and
+    // their remaining entries reinserted afterwards. Returns the number removed.
+    template <typename Pred>
+    size_t remove_if(const Rectangle& window, Pred pred) {
+        return bulk_remove(
+            [&](const Node<T>* n) { return Rectangle::overlap(n->mbr, window); },
+            [&](const LeafEntry<T>& e) {
+                return Rectangle::overlap(e.second, window) && pred(e.first, e.second);
+            });
+    }
+
+    // Removes every entry whose expiry time is <= t, descending only into
+    // nodes whose earliest expiry is <= t. Returns the number removed.
+    size_t expire_until(Timestamp t) {
+        if (!root || root->min_expiry > t)
+            return 0;
+        return bulk_remove([t](const Node<T>* n) { return n->min_expiry <= t; },
+                           [t](const LeafEntry<T>& e) { return e.expires_at <= t; });
+    }
+
+    // Approximate number of entries overlapping `rect`, for query planning. Subtrees fully
+    // inside `rect` contribute their entry count, leaves are counted exactly, and after
+    // `levels` levels a partially covered subtree contributes its count scaled by the
+    // fraction of its MBR that `rect` covers (assuming entries are spread uniformly).
+    [[nodiscard]] double estimate_count(const Rectangle& rect, int levels = 2) const {
+        if (!root)
+            return 0;
+        return _estimate_count(root, rect, levels);
+    }
+
+    // Returns min(k, matches) distinct entries overlapping `rect`, chosen uniformly at random
+    // without enumerating the window. Each draw descends from the root, picking among the
+    // overlapping children in proportion to their subtree counts; below the root the draw
+    // survives a node n with probability S(n) / count(n), S(n) being the count held by its
+    // overlapping children, and the entry picked at the leaf must itself overlap. That makes
+    // every entry in the window equally likely. Small windows are enumerated instead.
+    template <typename Rng>
+    std::vector<T*> sample(const Rectangle& rect, size_t k, Rng& rng) const {
+        std::vector<T*> result;
+        if (!root || k == 0)
+            return result;
+        if (2 * k >= estimate_count(rect))
+            return sample_enumerated(rect, k, rng);
+
+        std::unordered_set<const LeafEntry<T>*> seen;
+        for (size_t attempts = 0; result.size() < k; attempts++) {
+            // the estimate was off, or the window is mostly made of rejected boundary nodes
+            if (attempts == 64 * k)
+                return sample_enumerated(rect, k, rng);
+            auto entry = draw(rect, rng);
+            if (entry && seen.insert(entry).second)
+                result.push_back(entry->first);
+        }
+        return result;
+    }
+
+    // Scores every entry with score(*elem) and keeps the best score of each subtree up to date,
+    // which top_k() needs. Scores are taken at insertion time; calling this again rescores the
+    // whole tree, e.g. after payloads changed.
+    void enable_scores(std::function<double(const T&)> score) {
+        scorer = std::move(score);
+        if (root)
+            rescore(root);
+    }
+
+    // The k highest scoring entries overlapping `rect`, best first. Nodes are expanded in order
+    // of their best score, so the search stops as soon as k entries beat every subtree still
+    // waiting in the queue.
+    std::vector<T*> top_k(const Rectangle& rect, size_t k) const {
+        if (!scorer)
+            throw std::logic_error("top_k() needs enable_scores() first");
+        std::vector<T*> result;
+        if (!root || k == 0)
+            return result;
+
+        struct Candidate {
+            double bound;
+            const Node<T>* node;
+            const LeafEntry<T>* entry;
+            bool operator<(const Candidate& other) const { return bound < other.bound; }
+        };
+        std::priority_queue<Candidate> queue;
+        queue.push({root->max_score, root, nullptr});
+        while (!queue.empty() && result.size() < k) {
+            auto top = queue.top();
+            queue.pop();
+            if (top.entry) {
+                result.push_back(top.entry->first);
+            } else if (top.node->is_leaf) {
+                for (auto& elem_rec : top.node->elems) {
+                    if (Rectangle::overlap(elem_rec.second, rect))
+                        queue.push({elem_rec.score, nullptr, &elem_rec});
+                }
+            } else {
+                for (auto node : top.node->children) {
+                    if (Rectangle::overlap(node->mbr, rect))
+                        queue.push({node->max_score, node, nullptr});
+                }
+            }
+        }
+        return result;
+    }
+
+    // Neighbour lists as returned by the kNN queries, closest first.
+    using Neighbours = std::vector<T*>;
+
+    // The k entries nearest to `point`, measured to the closest point of their rectangles.
+    Neighbours nearest(const std::vector<double>& point, size_t k) const {
+        LatencyRecorder::Scope timer(latency.get(), Operation::knn);
+        if (!root || k == 0)
+            return {};
+        Rectangle query(point, point);
+        std::vector<Neighbours> found(1);
+        knn_group({{&query, nullptr}}, k, found);
+        return found[0];
+    }
+
+    // Same as nearest(), filling in `stats` along the way.
+    Neighbours nearest(const std::vector<double>& point, size_t k, QueryStats& stats) const {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<Neighbours> found(1);
+        if (root && k > 0) {
+            Rectangle query(point, point);
+            knn_group({{&query, nullptr}}, k, found, &stats);
+        }
+        stats.entries_returned = found[0].size();
+        stats.elapsed = std::chrono::steady_clock::now() - start;
+        return found[0];
+    }
+
+    // Runs nearest(point, k) and reports what it cost, as explain() does for window searches.
+    // A leaf counts as a false positive when none of its entries made the candidate list.
+    QueryStats explain_nearest(const std::vector<double>& point, size_t k) const {
+        QueryStats stats;
+        nearest(point, k, stats);
+        return stats;
+    }
+
+    // The k nearest neighbours of every entry in the tree (an entry is not its own neighbour),
+    // as (entry, neighbours) pairs. Each leaf is one batch: a single best-first traversal,
+    // pruned by the worst k-th distance in the batch, serves all of its entries. Batches are
+    // taken in Hilbert order of the leaf MBRs so consecutive ones touch mostly the same nodes,
+    // and are spread over `threads` workers. The tree must not change while this runs.
+    std::vector<std::pair<T*, Neighbours>> knn_all(size_t k,
+                                                   unsigned threads = default_threads()) const {
+        std::vector<std::pair<T*, Neighbours>> result;
+        if (!root || k == 0)
+            return result;
+        std::vector<const Node<T>*> leaves;
+        collect_leaves(root, leaves);
+        std::vector<std::vector<double>> centers;
+        for (auto leaf : leaves) centers.push_back(center(leaf->mbr));
+        auto order = hilbert_order(centers);
+
+        std::vector<size_t> offset(leaves.size() + 1, 0);
+        for (size_t i = 0; i < leaves.size(); i++)
+            offset[i + 1] = offset[i] + leaves[order[i]]->elems.size();
+        result.resize(offset.back());
+
+        parallel_for(leaves.size(), threads, [&](size_t i) {
+            auto leaf = leaves[order[i]];
+            std::vector<KnnQuery> queries;
+            for (auto& entry : leaf->elems) queries.push_back({&entry.second, &entry});
+            std::vector<Neighbours> found(queries.size());
+            knn_group(queries, k, found);
+            for (size_t j = 0; j < queries.size(); j++)
+                result[offset[i] + j] = {leaf->elems[j].first, std::move(found[j])};
+        });
+        return result;
+    }
+
+    // The k nearest entries of every point in `points`, in the same order as `points`. The
+    // points are sorted along a Hilbert curve and handled in batches of M, as in knn_all(k).
+    std::vector<Neighbours> knn_all(const std::vector<std::vector<double>>& points, size_t k,
+                                    unsigned threads = default_threads()) const {
+        std::vector<Neighbours> result(points.size());
+        if (!root || k == 0 || points.empty())
+            return result;
+        auto order = hilbert_order(points);
+        std::vector<Rectangle> rects;
+        for (auto& p : points) rects.emplace_back(p, p);
+
+        size_t batch = M;
+        parallel_for((points.size() + batch - 1) / batch, threads, [&](size_t b) {
+            size_t begin = b * batch, end = std::min(points.size(), begin + batch);
+            std::vector<KnnQuery> queries;
+            for (size_t i = begin; i < end; i++) queries.push_back({&rects[order[i]], nullptr});
+            std::vector<Neighbours> found(queries.size());
+            knn_group(queries, k, found);
+            for (size_t i = begin; i < end; i++) result[order[i]] = std::move(found[i - begin]);
+        });
+        return result;
+    }
+
+    // Calls visit(a, b) once for every unordered pair of distinct entries whose rectangles are
+    // within distance eps of each other. The tree is traversed against itself, descending only
+    // into node pairs whose MBRs are within eps; a node paired with itself visits each pair of
+    // its children once, which skips the symmetric duplicates. With threads > 1 the top node
+    // pairs are split among workers and visit is called concurrently, so it has to be
+    // thread-safe in that case.
+    template <typename Visitor>
+    void self_join_within(double eps, Visitor&& visit, unsigned threads = 1) const {
+        if (!root)
+            return;
+        double eps2 = eps * eps;
+        using NodePair = std::pair<const Node<T>*, const Node<T>*>;
+        std::vector<NodePair> tasks{{root, root}};
+        while (threads > 1 && tasks.size() < 16 * threads && !tasks.front().first->is_leaf) {
+            std::vector<NodePair> next;
+            for (auto [a, b] : tasks)
+                for_each_close_pair(a, b, eps2, [&](auto x, auto y) { next.push_back({x, y}); });
+            tasks = std::move(next);
+            if (tasks.empty())
+                return;
+        }
+        parallel_for(tasks.size(), threads,
+                     [&](size_t i) { _self_join(tasks[i].first, tasks[i].second, eps2, visit); });
+    }
+
+    // The k closest (this entry, other entry, distance) pairs between this tree and `other`,
+    // closest first. Node pairs are expanded best-first by the MINDIST of their MBRs. Every
+    // queued pair also promises count_a * count_b entry pairs no farther apart than its
+    // MAXDIST, so once the queue promises k pairs within some distance, new node pairs whose
+    // MINDIST is beyond it are dropped instead of queued.
+    template <typename U>
+    std::vector<std::tuple<T*, U*, double>> closest_pairs(const RTree<U>& other, size_t k) const {
+        std::vector<std::tuple<T*, U*, double>> result;
+        if (!root || !other.root || k == 0)
+            return result;
+
+        // Upper bounds on the k-th distance: the MAXDIST promised by the queued node pairs, and
+        // the k smallest entry pair distances seen so far. Nothing farther than the tighter of
+        // the two can make the result. The bound never grows, as expanding a node pair promises
+        // its entry pairs again at no larger MAXDIST, so a promise at or beyond it is dropped
+        // for good and the rest are kept only while the largest is needed to reach k pairs.
+        using Promise = std::tuple<double, size_t, size_t>;  // (MAXDIST, id, entry pairs)
+        std::set<Promise> promises;
+        size_t promised = 0, next_promise = 0;
+        std::priority_queue<double> nearest_k;
+        double bound = std::numeric_limits<double>::infinity();
+
+        struct Pending {
+            double mindist;
+            size_t pairs;  // entry pairs covered; on equal MINDIST the finer pair goes first
+            const Node<T>* a;
+            const Node<U>* b;
+            const LeafEntry<T>* entry_a;
+            const LeafEntry<U>* entry_b;
+            Promise promise;
+            bool operator>(const Pending& other) const {
+                return mindist != other.mindist ? mindist > other.mindist : pairs > other.pairs;
+            }
+        };
+        std::priority_queue<Pending, std::vector<Pending>, std::greater<>> queue;
+
+        auto add_nodes = [&](const Node<T>* a, const Node<U>* b) {
+            double mindist = min_dist(a->mbr, b->mbr);
+            if (mindist > bound)
+                return;
+            size_t pairs = a->subtree_count * b->subtree_count;
+            Promise promise{max_dist(a->mbr, b->mbr), next_promise++, pairs};
+            if (std::get<0>(promise) < bound) {
+                promises.insert(promise);
+                promised += pairs;
+            }
+            queue.push({mindist, pairs, a, b, nullptr, nullptr, promise});
+        };
+        auto add_entries = [&](const LeafEntry<T>* x, const LeafEntry<U>* y) {
+            double d = min_dist(x->second, y->second);
+            if (d > bound)
+                return;
+            queue.push({d, 1, nullptr, nullptr, x, y, {}});
+            nearest_k.push(d);
+            if (nearest_k.size() > k)
+                nearest_k.pop();
+            if (nearest_k.size() == k)
+                bound = std::min(bound, nearest_k.top());
+        };
+        auto tighten = [&] {
+            while (!promises.empty()) {
+                auto [maxdist, id, count] = *promises.rbegin();
+                if (maxdist < bound && promised - count < k) {
+                    if (promised >= k)
+                        bound = maxdist;
+                    return;
+                }
+                promised -= count;
+                promises.erase(std::prev(promises.end()));
+            }
+        };
+
+        add_nodes(root, other.root);
+        while (!queue.empty() && result.size() < k) {
+            auto top = queue.top();
+            queue.pop();
+            if (top.entry_a) {
+                result.emplace_back(top.entry_a->first, top.entry_b->first, std::sqrt(top.mindist));
+                continue;
+            }
+            if (promises.erase(top.promise))
+                promised -= top.pairs;
+            // expand one side at a time, the larger one unless it is already a leaf
+            if (top.a->is_leaf && top.b->is_leaf) {
+                for (auto& x : top.a->elems) {
+                    for (auto& y : top.b->elems) add_entries(&x, &y);
+                }
+            } else if (top.b->is_leaf ||
+                       (!top.a->is_leaf && top.a->mbr.area() >= top.b->mbr.area())) {
+                for (auto node : top.a->children) add_nodes(node, top.b);
+            } else {
+                for (auto node : top.b->children) add_nodes(top.a, node);
+            }
+            tighten();
+        }
+        return result;
+    }
+
+    // Bytes held by the tree's nodes, entries, rectangles and containers, plus modelled
+    // allocator overhead. Payloads are not included.
+    MemoryUsage memory_usage() const {
+        MemoryUsage usage;
+        if (root)
+            _memory_usage(root, usage);
+        return usage;
+    }
+
+    // Keeps the entries of every node sorted by their lower edge along `axis`, with the MBR of
+    // every Node::block_size consecutive entries beside them (-1 turns this off). Searches then
+    // binary-search past the entries starting beyond the window and skip blocks that miss it,
+    // so a wide node (M of 64 to 512) no longer costs a test per entry. Inserts pay for keeping
+    // each node on their path sorted.
+    void order_nodes(int axis) {
+        order_axis = axis;
+        if (root)
+            _order_nodes(root);
+    }
+
+    [[nodiscard]] int get_order_axis() const { return order_axis; }
+
+    // Starts recording the latency of every insert, remove, update, search and nearest call in
+    // per-operation histograms; off by default. Calling it again clears what was recorded.
+    void enable_latency_histograms() {
+        if (latency)
+            latency->reset();
+        else
+            latency = std::make_unique<LatencyRecorder>();
     }
 
+    // What has been recorded for `op` so far, merged over all threads; empty while off.
+    LatencySnapshot latency_histogram(Operation op) const {
+        return latency ? latency->snapshot(op) : LatencySnapshot();
+    }
+
+    static unsigned default_threads() { return std::max(1u, std::thread::hardware_concurrency()); }
+
    private:
     struct EntryWrapper {
         int index;
@@ -243,7 +941,7 @@ class RTree {
     void condense_tree(Node<T>* l) {
         Node<T>* n = l;
         std::vector<Node<T>*> internal_orphans;
-        std::vector<std::pair<T*, Rectangle>> leaf_entries_to_reinsert;
+        std::vector<LeafEntry<T>> leaf_entries_to_reinsert;
 
         // DEBUG: Track loop iterations to prevent infinite loops
         int loop_safety = 0;
@@ -305,32 +1003,428 @@ class RTree {
             root->parent = nullptr;
         }
 
-        for (const auto& entry : leaf_entries_to_reinsert) insert(entry.second, entry.first);
+        for (const auto& entry : leaf_entries_to_reinsert)
+            insert(entry.second, entry.first, entry.expires_at);
         for (Node<T>* subtree : internal_orphans) insert_subtree(subtree);
     }
 
-    void _impl_search(const Rectangle& s, std::vector<T*>& result, Node<T>* t = nullptr) const {
+    void _impl_search(const Rectangle& s, std::vector<T*>& result, Node<T>* t = nullptr,
+                      Timestamp now = std::numeric_limits<Timestamp>::min()) const {
         if (t == nullptr)
             t = root;
         if (t == nullptr)
             return;
 
+        if (t->is_leaf) {
+            t->scan(s, [&](size_t i) {
+                if (t->elems[i].expires_at > now)
+                    result.push_back(t->elems[i].first);
+            });
+            return;
+        }
+
+        t->scan(s, [&](size_t i) {
+            std::vector<T*> r;
+            _impl_search(s, r, t->children[i], now);
+            std::copy(r.begin(), r.end(), std::back_inserter(result));
+        });
+    }
+
+    // Depth-first in child order, starting after `from` while resuming; true once the page is
+    // full, with `path` leading to its last entry.
+    bool _page(const Node<T>* t, const Rectangle& s, size_t limit,
+               const std::vector<long long>& from, size_t depth, bool resume,
+               std::vector<long long>& path, std::vector<T*>& items) const {
+        long long start = 0;
+        if (resume)
+            start = depth < from.size() ? from[depth] + (t->is_leaf ? 1 : 0)
+                                        : std::numeric_limits<long long>::max();
+        path.resize(depth + 1);
+        for (long long i = std::max(start, 0ll); i < t->count(); i++) {
+            if (!Rectangle::overlap(t->rect(i), s))
+                continue;
+            path[depth] = i;
+            if (t->is_leaf) {
+                items.push_back(t->elems[i].first);
+                if (items.size() == limit)
+                    return true;
+            } else if (_page(t->children[i], s, limit, from, depth + 1, resume && i == start,
+                             path, items)) {
+                return true;
+            }
+        }
+        path.resize(depth);
+        return false;
+    }
+
+    void _order_nodes(Node<T>* n) {
+        n->order_axis = order_axis;
+        for (auto child : n->children) _order_nodes(child);
+        n->update_mbr();
+    }
+    void _memory_usage(const Node<T>* n, MemoryUsage& usage) const {
+        auto rect = [&](const Rectangle& r) {
+            usage.rectangles += usage.heap(r.min.capacity() * sizeof(double)) +
+                                usage.heap(r.max.capacity() * sizeof(double));
+        };
+        usage.nodes += usage.heap(sizeof(Node<T>));
+        rect(n->mbr);
+        usage.containers += usage.heap(n->children.capacity() * sizeof(Node<T>*));
+        usage.heap(n->elems.capacity() * sizeof(LeafEntry<T>));
+        usage.entries += n->elems.size() * sizeof(LeafEntry<T>);
+        usage.containers += (n->elems.capacity() - n->elems.size()) * sizeof(LeafEntry<T>);
+        usage.entry_count += n->elems.size();
+        for (auto& entry : n->elems) rect(entry.second);
+        usage.containers += usage.heap(n->blocks.capacity() * sizeof(Rectangle));
+        for (auto& block : n->blocks) rect(block);
+        for (auto child : n->children) _memory_usage(child, usage);
+    }
+
+    void _explain_search(const Node<T>* t, const Rectangle& s, size_t level,
+                         std::vector<T*>& result, QueryStats& stats) const {
+        stats.visit_node(level);
+        if (t->is_leaf) {
+            size_t before = result.size();
+            size_t tests = t->scan(
+                s, [&](size_t i) { result.push_back(t->elems[i].first); }, &stats.mbr_tests);
+            stats.mbr_tests += tests;
+            stats.entries_scanned += tests;
+            if (result.size() == before)
+                stats.false_positive_leaves++;
+            return;
+        }
+        size_t tests = t->scan(
+            s, [&](size_t i) { _explain_search(t->children[i], s, level + 1, result, stats); },
+            &stats.mbr_tests);
+        stats.mbr_tests += tests;
+    }
+
+    template <typename Visitor>
+    void _visit(const Node<T>* t, const Rectangle& s, Visitor& visit) const {
+        if (t->is_leaf) {
+            t->scan(s, [&](size_t i) { visit(t->elems[i].first, t->elems[i].second); });
+            return;
+        }
+        t->scan(s, [&](size_t i) { _visit(t->children[i], s, visit); });
+    }
+
+    LeafEntry<T> make_entry(T* elem, const Rectangle& mbr, Timestamp expires_at) const {
+        LeafEntry<T> entry(elem, mbr, expires_at);
+        if (scorer)
+            entry.score = scorer(*elem);
+        return entry;
+    }
+
+    void rescore(Node<T>* n) {
+        if (n->is_leaf) {
+            for (auto& entry : n->elems) entry.score = scorer(*entry.first);
+        } else {
+            for (auto node : n->children) rescore(node);
+        }
+        n->update_mbr();
+    }
+
+    struct KnnQuery {
+        const Rectangle* rect;
+        const LeafEntry<T>* self;  // excluded from its own neighbours
+    };
+
+    // Best-first kNN search for a batch of queries sharing one traversal. Nodes are visited in
+    // order of their distance to the MBR of the whole batch until none can improve any query's
+    // current k-th distance; leaves are skipped per query using that query's own bound.
+    void knn_group(const std::vector<KnnQuery>& queries, size_t k, std::vector<Neighbours>& found,
+                   QueryStats* stats = nullptr) const {
+        using Candidate = std::pair<double, T*>;
+        std::vector<std::priority_queue<Candidate>> best(queries.size());
+        auto bound = [&](size_t q) {
+            if (best[q].size() < k)
+                return std::numeric_limits<double>::infinity();
+            return best[q].top().first;
+        };
+
+        Rectangle group = *queries[0].rect;
+        for (auto& query : queries) group = Rectangle::calc_mbr(group, *query.rect);
+
+        // (distance to the batch, node, level)
+        using Pending = std::tuple<double, const Node<T>*, size_t>;
+        std::priority_queue<Pending, std::vector<Pending>, std::greater<>> frontier;
+        frontier.push({min_dist(root->mbr, group), root, 0});
+        while (!frontier.empty()) {
+            auto [dist, n, level] = frontier.top();
+            frontier.pop();
+            double worst = 0;
+            for (size_t q = 0; q < queries.size(); q++) worst = std::max(worst, bound(q));
+            if (dist > worst)
+                break;
+            if (stats)
+                stats->visit_node(level);
+            if (!n->is_leaf) {
+                for (auto node : n->children)
+                    frontier.push({min_dist(node->mbr, group), node, level + 1});
+                if (stats)
+                    stats->mbr_tests += n->children.size();
+                continue;
+            }
+            bool contributed = false;
+            for (size_t q = 0; q < queries.size(); q++) {
+                if (stats)
+                    stats->mbr_tests++;
+                if (min_dist(n->mbr, *queries[q].rect) > bound(q))
+                    continue;
+                if (stats) {
+                    stats->mbr_tests += n->elems.size();
+                    stats->entries_scanned += n->elems.size();
+                }
+                for (auto& entry : n->elems) {
+                    if (&entry == queries[q].self)
+                        continue;
+                    double d = min_dist(entry.second, *queries[q].rect);
+                    if (best[q].size() < k) {
+                        best[q].push({d, entry.first});
+                        contributed = true;
+                    } else if (d < best[q].top().first) {
+                        best[q].pop();
+                        best[q].push({d, entry.first});
+                        contributed = true;
+                    }
+                }
+            }
+            if (stats && !contributed)
+                stats->false_positive_leaves++;
+        }
+
+        for (size_t q = 0; q < queries.size(); q++) {
+            found[q].resize(best[q].size());
+            for (size_t i = found[q].size(); i-- > 0; best[q].pop())
+                found[q][i] = best[q].top().second;
+        }
+    }
+
+    template <typename Visitor>
+    void _self_join(const Node<T>* a, const Node<T>* b, double eps2, Visitor& visit) const {
+        if (!a->is_leaf) {
+            for_each_close_pair(a, b, eps2,
+                                [&](auto x, auto y) { _self_join(x, y, eps2, visit); });
+            return;
+        }
+        for (size_t i = 0; i < a->elems.size(); i++) {
+            for (size_t j = (a == b ? i + 1 : 0); j < b->elems.size(); j++) {
+                if (min_dist(a->elems[i].second, b->elems[j].second) <= eps2)
+                    visit(a->elems[i].first, b->elems[j].first);
+            }
+        }
+    }
+
+    // Calls fn on every pair of children of a and b whose MBRs are within the distance,
+    // taking each unordered pair once when a == b.
+    template <typename Fn>
+    static void for_each_close_pair(const Node<T>* a, const Node<T>* b, double eps2, Fn fn) {
+        for (size_t i = 0; i < a->children.size(); i++) {
+            for (size_t j = (a == b ? i : 0); j < b->children.size(); j++) {
+                if (min_dist(a->children[i]->mbr, b->children[j]->mbr) <= eps2)
+                    fn(a->children[i], b->children[j]);
+            }
+        }
+    }
+
+    // Squared distance between the farthest points of two rectangles.
+    static double max_dist(const Rectangle& a, const Rectangle& b) {
+        double sum = 0;
+        for (int i = 0; i < a.min.size(); i++) {
+            double span = std::max(a.max[i] - b.min[i], b.max[i] - a.min[i]);
+            sum += span * span;
+        }
+        return sum;
+    }
+
+    // Squared distance between the closest points of two rectangles.
+    static double min_dist(const Rectangle& a, const Rectangle& b) {
+        double sum = 0;
+        for (int i = 0; i < a.min.size(); i++) {
+            double gap = std::max({0.0, a.min[i] - b.max[i], b.min[i] - a.max[i]});
+            sum += gap * gap;
+        }
+        return sum;
+    }
+
+    static std::vector<double> center(const Rectangle& r) {
+        std::vector<double> c(r.min.size());
+        for (int i = 0; i < c.size(); i++) c[i] = (r.min[i] + r.max[i]) / 2;
+        return c;
+    }
+
+    static void collect_leaves(const Node<T>* n, std::vector<const Node<T>*>& leaves) {
+        if (n->is_leaf) {
+            if (!n->elems.empty())
+                leaves.push_back(n);
+            return;
+        }
+        for (auto node : n->children) collect_leaves(node, leaves);
+    }
+
+    // Runs fn(0) ... fn(n - 1) on up to `threads` threads, handing out indices in order.
+    template <typename Fn>
+    static void parallel_for(size_t n, unsigned threads, Fn fn) {
+        threads = std::max(1u, (unsigned)std::min<size_t>(threads, n));
+        std::atomic<size_t> next{0};
+        auto worker = [&] {
+            for (size_t i; (i = next++) < n;) fn(i);
+        };
+        std::vector<std::thread> pool;
+        for (unsigned t = 1; t < threads; t++) pool.emplace_back(worker);
+        worker();
+        for (auto& thread : pool) thread.join();
+    }
+
+    // One attempt of the rejection descent used by sample(); nullptr when rejected.
+    template <typename Rng>
+    const LeafEntry<T>* draw(const Rectangle& rect, Rng& rng) const {
+        const Node<T>* n = root;
+        while (!n->is_leaf) {
+            size_t total = 0;
+            for (auto node : n->children) {
+                if (Rectangle::overlap(node->mbr, rect))
+                    total += node->subtree_count;
+            }
+            if (total == 0)
+                return nullptr;
+            if (n != root &&
+                std::uniform_int_distribution<size_t>(1, n->subtree_count)(rng) > total)
+                return nullptr;
+            size_t pick = std::uniform_int_distribution<size_t>(0, total - 1)(rng);
+            for (auto node : n->children) {
+                if (!Rectangle::overlap(node->mbr, rect))
+                    continue;
+                if (pick < node->subtree_count) {
+                    n = node;
+                    break;
+                }
+                pick -= node->subtree_count;
+            }
+        }
+        if (n->elems.empty())
+            return nullptr;
+        auto& entry = n->elems[std::uniform_int_distribution<size_t>(0, n->elems.size() - 1)(rng)];
+        return Rectangle::overlap(entry.second, rect) ? &entry : nullptr;
+    }
+
+    template <typename Rng>
+    std::vector<T*> sample_enumerated(const Rectangle& rect, size_t k, Rng& rng) const {
+        std::vector<T*> all;
+        visit(rect, [&](T* elem, const Rectangle&) { all.push_back(elem); });
+        k = std::min(k, all.size());
+        for (size_t i = 0; i < k; i++)
+            std::swap(all[i], all[std::uniform_int_distribution<size_t>(i, all.size() - 1)(rng)]);
+        all.resize(k);
+        return all;
+    }
+
+    double _estimate_count(const Node<T>* t, const Rectangle& rect, int levels) const {
+        if (!Rectangle::overlap(t->mbr, rect))
+            return 0;
+        double fraction = covered_fraction(t->mbr, rect);
+        if (fraction == 1)
+            return t->subtree_count;
+        if (t->is_leaf) {
+            size_t n = 0;
+            for (auto& elem_rec : t->elems) n += Rectangle::overlap(elem_rec.second, rect);
+            return n;
+        }
+        if (levels <= 0)
+            return fraction * t->subtree_count;
+        double sum = 0;
+        for (auto node : t->children) sum += _estimate_count(node, rect, levels - 1);
+        return sum;
+    }
+
+    // Fraction of mbr's volume lying inside rect (the two must overlap). Axes where mbr is
+    // flat count as fully covered.
+    static double covered_fraction(const Rectangle& mbr, const Rectangle& rect) {
+        double fraction = 1;
+        for (int i = 0; i < mbr.min.size(); i++) {
+            double lo = std::max(mbr.min[i], rect.min[i]);
+            double hi = std::min(mbr.max[i], rect.max[i]);
+            double extent = mbr.max[i] - mbr.min[i];
+            if (extent > 0)
+                fraction *= (hi - lo) / extent;
+        }
+        return fraction;
+    }
+
+    template <typename Visitor>
+    void _containing(const Node<T>* t, const std::vector<double>& p, Visitor& visit) const {
         if (t->is_leaf) {
             for (auto& elem_rec : t->elems) {
-                if (Rectangle::overlap(elem_rec.second, s))
-                    result.push_back(elem_rec.first);
+                if (elem_rec.second.contains_point(p))
+                    visit(elem_rec.first, elem_rec.second);
             }
             return;
         }
+        for (auto node : t->children) {
+            if (node->mbr.contains_point(p))
+                _containing(node, p, visit);
+        }
+    }
 
+    template <typename Visitor>
+    void _containing_batch(const Node<T>* t, const std::vector<size_t>& batch, size_t depth,
+                           const std::vector<std::vector<double>>& points,
+                           std::vector<std::vector<size_t>>& scratch, Visitor& visit) const {
+        if (t->is_leaf) {
+            for (auto i : batch) {
+                for (auto& elem_rec : t->elems) {
+                    if (elem_rec.second.contains_point(points[i]))
+                        visit(i, elem_rec.first, elem_rec.second);
+                }
+            }
+            return;
+        }
+        // scratch[depth] is only reused once the child using it has been fully processed
+        auto& subset = scratch[depth];
         for (auto node : t->children) {
-            if (Rectangle::overlap(node->mbr, s)) {
-                std::vector<T*> r;
-                _impl_search(s, r, node);
-                std::copy(r.begin(), r.end(), std::back_inserter(result));
+            subset.clear();
+            for (auto i : batch) {
+                if (node->mbr.contains_point(points[i]))
+                    subset.push_back(i);
             }
+            if (!subset.empty())
+                _containing_batch(node, subset, depth + 1, points, scratch, visit);
         }
     }
+
+    // Indices of `points` sorted by the Hilbert key of each point, quantized over the bounding
+    // box of the batch.
+    static std::vector<size_t> hilbert_order(const std::vector<std::vector<double>>& points) {
+        std::vector<size_t> order(points.size());
+        for (size_t i = 0; i < order.size(); i++) order[i] = i;
+        int dim = points.front().size();
+        int bits = std::min(16, 62 / std::max(dim, 1));
+        if (bits < 1)
+            return order;
+
+        std::vector<double> lo = points.front(), hi = points.front();
+        for (auto& p : points) {
+            for (int d = 0; d < dim; d++) {
+                lo[d] = std::min(lo[d], p[d]);
+                hi[d] = std::max(hi[d], p[d]);
+            }
+        }
+        HilbertCurve curve(bits, dim);
+        double cells = (1ll << bits) - 1;
+        std::vector<ll> keys(points.size());
+        Point cell(dim);
+        for (size_t i = 0; i < points.size(); i++) {
+            for (int d = 0; d < dim; d++) {
+                double extent = hi[d] - lo[d];
+                cell[d] = extent > 0 ? (ll)((points[i][d] - lo[d]) / extent * cells) : 0;
+            }
+            keys[i] = curve.index(cell);
+        }
+        std::sort(order.begin(), order.end(),
+                  [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+        return order;
+    }
+
     Node<T>* choose_leaf(Rectangle s, Node<T>* n = nullptr) {
         if (!n)
             n = root;
@@ -378,9 +1472,10 @@ class RTree {
             return;
         } else if (p == nullptr && ll != nullptr) {  // root was split
             auto rect = Rectangle::calc_mbr(ll->mbr, l->mbr);
-            root = new Node<T>(false, rect);
+            root = new Node<T>(false, rect, order_axis);
             root->children = std::vector<Node<T>*>{l, ll};
             l->parent = ll->parent = root;
+            root->update_mbr();
             return;
         } else if (p != nullptr && ll == nullptr) {  // just adjust the mbr
             update_mbr(p);
@@ -459,13 +1554,13 @@ class RTree {
             }
         }
 
-        auto tt = new Node<T>{t->is_leaf, mbr2};
+        auto tt = new Node<T>{t->is_leaf, mbr2, t->order_axis};
         tt->parent = t->parent;
         t->mbr = mbr1;
 
         if (t->is_leaf) {
-            std::vector<std::pair<T*, Rectangle>> elems1;
-            std::vector<std::pair<T*, Rectangle>> elems2;
+            std::vector<LeafEntry<T>> elems1;
+            std::vector<LeafEntry<T>> elems2;
 
             for (auto i : g1) elems1.push_back(t->elems[i]);
             for (auto i : g2) elems2.push_back(t->elems[i]);
@@ -499,6 +1594,8 @@ class RTree {
             }
         }
 
+        t->update_mbr();
+        tt->update_mbr();
         return tt;
     }
 
@@ -568,22 +1665,10 @@ class RTree {
         if (!n || n->count() == 0)
             return;
 
-        if (n->is_leaf) {
-            // Calculate MBR from elements
-            n->mbr = n->elems[0].second;
-            for (size_t i = 1; i < n->elems.size(); i++) {
-                n->mbr = Rectangle::calc_mbr(n->mbr, n->elems[i].second);
-            }
-        } else {
-            // Calculate MBR from children
-            n->mbr = n->children[0]->mbr;
-            for (size_t i = 1; i < n->children.size(); i++) {
-                n->mbr = Rectangle::calc_mbr(n->mbr, n->children[i]->mbr);
-            }
-        }
+        n->update_mbr();
     }
 
-    void collect_data_from_subtree(Node<T>* node, std::vector<std::pair<T*, Rectangle>>& data) {
+    void collect_data_from_subtree(Node<T>* node, std::vector<LeafEntry<T>>& data) {
         if (node->is_leaf) {
             for (auto& elem : node->elems) {
                 data.push_back(elem);
@@ -610,7 +1695,7 @@ class RTree {
         // Store orphans.
         // Items are for leaf underflows.
         // Nodes are for internal node underflows (The Optimization).
-        std::vector<std::pair<T*, Rectangle>> leaf_orphans;
+        std::vector<LeafEntry<T>> leaf_orphans;
         std::vector<Node<T>*> subtree_orphans;
 
         // 1. ASCEND AND COLLECT ORPHANS
@@ -672,7 +1757,7 @@ class RTree {
 
         // 4. REINSERT LEAF ITEMS (Standard Insert)
         for (const auto& entry : leaf_orphans) {
-            insert(entry.second, entry.first);
+            insert(entry.second, entry.first, entry.expires_at);
         }
 
         // 5. REINSERT SUBTREES (Grafting)
@@ -689,7 +1774,7 @@ class RTree {
         // CASE 1: The subtree is taller than (or equal to) the current root.
         // We must grow the tree upwards to accommodate this large orphan.
         while (subtree_height >= root_height) {
-            Node<T>* new_root = new Node<T>(false, root->mbr);
+            Node<T>* new_root = new Node<T>(false, root->mbr, order_axis);
             new_root->children.push_back(root);
             root->parent = new_root;
             root = new_root;
@@ -846,7 +1931,7 @@ class RTree {
         // If the orphan is as tall as the root, we must create a new root
         // to hold both the old root and the orphan.
         if (subtree_height >= root_height) {
-            Node<T>* new_root = new Node<T>(false, root->mbr);  // Internal
+            Node<T>* new_root = new Node<T>(false, root->mbr, order_axis);  // Internal
             new_root->children.push_back(root);
             root->parent = new_root;
 
@@ -883,5 +1968,93 @@ class RTree {
     }
 
     void reinsert_subtree(Node<T>* node) { return; }
+
+    // Shared driver for remove_if/expire_until: `visit` decides which subtrees
+    // are worth descending into, `doomed` which leaf entries go.
+    template <typename Visit, typename Doomed>
+    size_t bulk_remove(Visit visit, Doomed doomed) {
+        if (!root)
+            return 0;
+
+        std::vector<LeafEntry<T>> orphans;
+        size_t removed = _bulk_remove(root, visit, doomed, orphans);
+        if (removed == 0)
+            return 0;
+
+        // orphans are counted again by insert()
+        size -= removed + orphans.size();
+        shrink_root();
+
+        for (const auto& entry : orphans) insert(entry.second, entry.first, entry.expires_at);
+        return removed;
+    }
+
+    template <typename Visit, typename Doomed>
+    size_t _bulk_remove(Node<T>* n, Visit& visit, Doomed& doomed,
+                        std::vector<LeafEntry<T>>& orphans) {
+        size_t removed = 0;
+
+        if (n->is_leaf) {
+            auto it = std::remove_if(n->elems.begin(), n->elems.end(), doomed);
+            removed = std::distance(it, n->elems.end());
+            n->elems.erase(it, n->elems.end());
+            if (removed)
+                update_mbr(n);
+            return removed;
+        }
+
+        std::vector<Node<T>*> dissolved;
+        for (auto child : n->children) {
+            if (!visit(child))
+                continue;
+            size_t r = _bulk_remove(child, visit, doomed, orphans);
+            removed += r;
+            if (r && child->count() < m)
+                dissolved.push_back(child);
+        }
+
+        // Underfull children are rebuilt from scratch: their survivors are
+        // reinserted once the walk is done, which keeps every leaf at one depth.
+        for (auto child : dissolved) {
+            n->children.erase(std::find(n->children.begin(), n->children.end(), child));
+            gather_entries(child, orphans);
+            delete child;
+        }
+
+        if (removed)
+            update_mbr(n);
+        return removed;
+    }
+
+    void gather_entries(Node<T>* n, std::vector<LeafEntry<T>>& out) {
+        if (n->is_leaf) {
+            out.insert(out.end(), n->elems.begin(), n->elems.end());
+            return;
+        }
+        for (auto child : n->children) gather_entries(child, out);
+    }
+
+    // Drops useless root levels left behind by bulk removal.
+    void shrink_root() {
+        while (root && !root->is_leaf && root->children.size() <= 1) {
+            Node<T>* old_root = root;
+            root = root->children.empty() ? nullptr : root->children[0];
+            old_root->children.clear();
+            delete old_root;
+            if (root)
+                root->parent = nullptr;
+        }
+        if (root && root->is_leaf && root->count() == 0) {
+            delete root;
+            root = nullptr;
+        }
+    }
 };
+
+// The k closest pairs between the entries of two trees; see RTree::closest_pairs().
+template <typename A, typename B>
+std::vector<std::tuple<A*, B*, double>> closest_pairs(const RTree<A>& a, const RTree<B>& b,
+                                                      size_t k) {
+    return a.closest_pairs(b, k);
+}
 }  // namespace Gutman
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
+#include <cstddef>
 #include <functional>
+#include <iterator>
 #include <stdexcept>
 #include <vector>
 using ll = long long;
@@ -23,27 +25,94 @@ class Box {
         return true;
     }
 
-    void visit_perimiter(std::function<void(const Point&)> func) const {
-        Point p(dim);
-
-        std::function<void(int)> dfs = [&](int d) {
-            if (d == dim) {
-                bool isPerimiter = false;
-                for (int i = 0; i < dim; i++) {
-                    if (p[i] == lo[i] || p[i] == hi[i]) {
-                        isPerimiter = true;
-                        break;
+    // Forward iterator over the cells on the box's boundary, face by face: the cells of face d
+    // lie on lo[d] or hi[d] and strictly inside the box on every axis before d, so each cell is
+    // produced exactly once and the interior is never touched. The only allocation is the
+    // current cell, made once per enumeration.
+    class PerimeterIterator {
+       public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Point;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Point*;
+        using reference = const Point&;
+
+        PerimeterIterator() = default;  // the end
+        explicit PerimeterIterator(const Box& box) : box(&box), cell(box.dim), face(-1) {
+            next_face();
+        }
+
+        reference operator*() const { return cell; }
+        pointer operator->() const { return &cell; }
+
+        PerimeterIterator& operator++() {
+            // odometer, last axis fastest
+            for (int i = box->dim - 1; i >= 0; i--) {
+                if (i == face) {
+                    if (cell[i] != box->hi[i]) {
+                        cell[i] = box->hi[i];
+                        return *this;
                     }
+                } else if (cell[i] < last(i)) {
+                    cell[i]++;
+                    return *this;
                 }
-                if (isPerimiter)
-                    func(p);
-            } else {
-                for (auto x = lo[d]; x <= hi[d]; x++) {
-                    p[d] = x;
-                    dfs(d + 1);
+                cell[i] = first(i);
+            }
+            next_face();
+            return *this;
+        }
+
+        PerimeterIterator operator++(int) {
+            auto old = *this;
+            ++*this;
+            return old;
+        }
+
+        bool operator==(const PerimeterIterator& other) const {
+            if (!box || !other.box)
+                return box == other.box;
+            return face == other.face && cell == other.cell;
+        }
+        bool operator!=(const PerimeterIterator& other) const { return !(*this == other); }
+
+       private:
+        const Box* box = nullptr;
+        Point cell;
+        int face = 0;
+
+        ll first(int i) const { return i < face ? box->lo[i] + 1 : box->lo[i]; }
+        ll last(int i) const { return i < face ? box->hi[i] - 1 : box->hi[i]; }
+
+        // Moves to the first cell of the next non-empty face, or becomes the end iterator.
+        void next_face() {
+            while (++face < box->dim) {
+                bool empty = false;
+                for (int i = 0; i < box->dim; i++) {
+                    cell[i] = first(i);
+                    empty |= first(i) > last(i);
                 }
+                if (!empty)
+                    return;
             }
-        };
-        dfs(0);
+            box = nullptr;
+        }
+    };
+
+    struct Perimeter {
+        const Box& box;
+        PerimeterIterator begin() const { return PerimeterIterator(box); }
+        PerimeterIterator end() const { return PerimeterIterator(); }
+    };
+
+    Perimeter perimeter() const { return {*this}; }
+
+    template <typename Visit>
+    void visit_perimiter(Visit&& visit) const {
+        for (auto it = PerimeterIterator(*this); it != PerimeterIterator(); ++it) visit(*it);
+    }
+
+    void visit_perimiter(std::function<void(const Point&)> func) const {
+        visit_perimiter<std::function<void(const Point&)>&>(func);
     }
-};
\ No newline at end of file
+};
@@ -0,0 +1,88 @@
+#pragma once
+#include <optional>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "rtree_hilbert/hilbert_rtree.h"
+
+namespace hilbert {
+
+// Sliding-window query over an RTree. Every move_to() reports only the entries that entered
+// or left the window since the previous call, and only the parts of the new and old windows
+// that do not overlap each other are searched, so the cost of a pan follows the size of the
+// change instead of the size of the window.
+//
+// The tree must not be modified between two calls; call reset() after changing it.
+template <typename T, typename Curve = HilbertCurve>
+class ContinuousQuery {
+   public:
+    struct Delta {
+        std::vector<T*> added;
+        std::vector<T*> removed;
+    };
+
+    explicit ContinuousQuery(const RTree<T, Curve>& tree) : tree(tree) {}
+
+    Delta move_to(const Rectangle& next) {
+        Delta delta;
+        if (!window) {
+            tree.visit(next, [&](T* elem, const Rectangle&) { delta.added.push_back(elem); });
+        } else {
+            // entered = overlaps next but not the old window, left = the reverse
+            collect(difference(next, *window), next, *window, delta.added);
+            collect(difference(*window, next), *window, next, delta.removed);
+        }
+        window = next;
+        return delta;
+    }
+
+    // Forgets the previous window; the next move_to() reports everything inside its window.
+    void reset() { window.reset(); }
+
+    const std::optional<Rectangle>& current_window() const { return window; }
+
+   private:
+    const RTree<T, Curve>& tree;
+    std::optional<Rectangle> window;
+
+    // Entries found in `pieces` that overlap `inside` but not `outside`. An entry can span
+    // several pieces, so the address of its stored rectangle is used to report it once.
+    void collect(const std::vector<Rectangle>& pieces, const Rectangle& inside,
+                 const Rectangle& outside, std::vector<T*>& out) const {
+        std::unordered_set<const Rectangle*> seen;
+        for (auto& piece : pieces) {
+            tree.visit(piece, [&](T* elem, const Rectangle& rect) {
+                if (rect.intersects(inside) && !rect.intersects(outside) &&
+                    seen.insert(&rect).second)
+                    out.push_back(elem);
+            });
+        }
+    }
+
+    // Covers a \ b with at most 2 * dim slabs: slab i is cut along axis i and clipped to the
+    // overlap of a and b on every earlier axis.
+    static std::vector<Rectangle> difference(const Rectangle& a, const Rectangle& b) {
+        if (!a.intersects(b))
+            return {a};
+        std::vector<Rectangle> pieces;
+        Rectangle rest = a;
+        for (size_t i = 0; i < a.lower.size(); i++) {
+            if (rest.lower[i] < b.lower[i]) {
+                Rectangle slab = rest;
+                slab.higher[i] = b.lower[i] - 1;
+                pieces.push_back(std::move(slab));
+                rest.lower[i] = b.lower[i];
+            }
+            if (rest.higher[i] > b.higher[i]) {
+                Rectangle slab = rest;
+                slab.lower[i] = b.higher[i] + 1;
+                pieces.push_back(std::move(slab));
+                rest.higher[i] = b.higher[i];
+            }
+        }
+        return pieces;
+    }
+};
+
+}  // namespace hilbert
@@ -9,18 +9,146 @@
 using ll = long long;
 using Point = std::vector<ll>;
 
+// Compact Hilbert indices, after Hamilton and Rau-Chaplin, "Compact Hilbert indices: Space-
+// filling curves for domains with unequal side lengths" (2008). Each level of the curve is an
+// n-bit Gray code walk through the sub-cubes, rotated and reflected by the entry point e and
+// direction d of the current cell; axes that have run out of bits at a level pin their bit of
+// the Gray code, and only the free bits are emitted.
+namespace {
+
+using Word = unsigned long long;
+
+Word rotr(Word x, int r, int n) {
+    Word mask = n == 64 ? ~0ull : (1ull << n) - 1;
+    r %= n;
+    x &= mask;
+    return r ? ((x >> r) | (x << (n - r))) & mask : x;
+}
+
+Word rotl(Word x, int r, int n) { return rotr(x, n - r % n, n); }
+
+Word gray(Word i) { return i ^ (i >> 1); }
+
+Word gray_inverse(Word g) {
+    for (int s = 1; s < 64; s <<= 1) g ^= g >> s;
+    return g;
+}
+
+int trailing_set_bits(Word i) {
+    int count = 0;
+    for (; i & 1; i >>= 1) count++;
+    return count;
+}
+
+// entry corner of sub-cube w
+Word entry(Word w) { return w == 0 ? 0 : gray(2 * ((w - 1) / 2)); }
+
+// axis along which the curve leaves sub-cube w
+int direction(Word w, int n) {
+    if (w == 0)
+        return 0;
+    return (w & 1 ? trailing_set_bits(w) : trailing_set_bits(w - 1)) % n;
+}
+
+// axes that still have a bit at `level`
+Word free_axes(const std::vector<int>& axis_bits, int level) {
+    Word mask = 0;
+    for (size_t j = 0; j < axis_bits.size(); j++) {
+        if (axis_bits[j] > level)
+            mask |= 1ull << j;
+    }
+    return mask;
+}
+
+ll compact_index(const std::vector<int>& axis_bits, int levels, const Point& p) {
+    int n = axis_bits.size();
+    Word h = 0, e = 0;
+    int d = 0;
+    for (int i = levels - 1; i >= 0; i--) {
+        Word mu = rotr(free_axes(axis_bits, i), d + 1, n);
+        Word l = 0;
+        for (int j = 0; j < n; j++) l |= Word((p[j] >> i) & 1) << j;
+        Word w = gray_inverse(rotr(l ^ e, d + 1, n));
+        // rank of w among the Gray codes agreeing on the pinned bits: its bits at the free ones
+        for (int k = n - 1; k >= 0; k--) {
+            if (mu >> k & 1)
+                h = (h << 1) | (w >> k & 1);
+        }
+        e ^= rotl(entry(w), d + 1, n);
+        d = (d + direction(w, n) + 1) % n;
+    }
+    return ll(h);
+}
+
+void compact_point(const std::vector<int>& axis_bits, int levels, ll index, Point& p) {
+    int n = axis_bits.size();
+    int remaining = 0;
+    for (auto b : axis_bits) remaining += b;
+    for (auto& c : p) c = 0;
+    Word e = 0;
+    int d = 0;
+    for (int i = levels - 1; i >= 0; i--) {
+        Word mu = rotr(free_axes(axis_bits, i), d + 1, n);
+        Word pi = rotr(e, d + 1, n) & ~mu;
+        // rebuild w from its free bits and the pinned bits of its Gray code gray(w) = pi
+        Word w = 0, g = 0;
+        for (int k = n - 1; k >= 0; k--) {
+            Word above = k + 1 < n ? (w >> (k + 1)) & 1 : 0;
+            Word bit;
+            if (mu >> k & 1) {
+                bit = (Word(index) >> --remaining) & 1;
+                g |= (bit ^ above) << k;
+            } else {
+                g |= pi & (1ull << k);
+                bit = ((pi >> k) & 1) ^ above;
+            }
+            w |= bit << k;
+        }
+        Word l = rotl(g, d + 1, n) ^ e;
+        for (int j = 0; j < n; j++) p[j] |= ll((l >> j) & 1) << i;
+        e ^= rotl(entry(w), d + 1, n);
+        d = (d + direction(w, n) + 1) % n;
+    }
+}
+
+}  // namespace
+
+HilbertCurve::HilbertCurve(std::vector<int> axis_bits)
+    : bits(0), dim(axis_bits.size()), len(0), axis_bits(std::move(axis_bits)), compact(false) {
+    if (dim < 1)
+        throw std::domain_error("You can't have negative dimensions or bits");
+    for (auto b : this->axis_bits) {
+        if (b < 1)
+            throw std::domain_error("You can't have negative dimensions or bits");
+        compact |= b != this->axis_bits[0];
+        bits = std::max(bits, b);
+        len += b;
+    }
+    if (compact && len > 63)
+        throw std::domain_error("Per-axis bits must add up to at most 63");
+}
+
 ll HilbertCurve::index(const Point& point) const {
+    if (compact)
+        return compact_index(axis_bits, bits, point);
     Point x(point);
     auto y = transposed_index(bits, x);
     return to_index(y);
 }
 
 Point HilbertCurve::point(ll index) const {
+    if (compact) {
+        Point p(dim);
+        compact_point(axis_bits, bits, index, p);
+        return p;
+    }
     auto p = transpose(index);
     return transposed_index_to_point(bits, p);
 }
 
 void HilbertCurve::point(ll index, Point& x) const {
+    if (compact)
+        return compact_point(axis_bits, bits, index, x);
     for (auto& v : x) v = 0;
     transpose(index, x);
     transposed_index_to_point(bits, x);
@@ -122,7 +250,7 @@ ll HilbertCurve::max_ordinate() const {
 }
 
 ll HilbertCurve::max_index() const {
-    return (1 << (bits * dim)) - 1;
+    return compact ? (1ll << len) - 1 : (1 << (bits * dim)) - 1;
 }
 
 Ranges HilbertCurve::query(const Point& a, const Point& b, int max_ranges, int buffer_size) const {
@@ -134,26 +262,30 @@ Ranges HilbertCurve::query(const Point& a, const Point& b, int max_ranges, int b
     Box box(a, b);
 
     std::vector<ll> list;
-
-    box.visit_perimiter([&](const Point& cell) {
-        auto n = index(cell);
-        list.push_back(n);
-    });
+    for (const auto& cell : box.perimeter()) list.push_back(index(cell));
 
     std::sort(list.begin(), list.end());
 
-    Ranges ranges(buffer_size > 0 ? buffer_size : 1024);
+    Ranges ranges;
     if (list.empty())
         return ranges;
 
     ll range_start = list[0];
     ll range_end = list[0];
     for (size_t i = 1; i < list.size(); i++) {
+        // The curve moves between neighbouring cells, and it cannot pass between the inside and
+        // the outside of the box without stepping on a boundary cell, so the keys between two
+        // consecutive boundary keys are all inside or all outside and one of them decides.
+        // Compact indices can jump, so there every key is checked.
         bool continuous = true;
-        for (ll idx = range_end + 1; idx < list[i]; idx++) {
-            if (!box.contains(point(idx))) {
-                continuous = false;
-                break;
+        if (!compact && range_end + 1 < list[i]) {
+            continuous = box.contains(point(range_end + 1));
+        } else {
+            for (ll idx = range_end + 1; idx < list[i]; idx++) {
+                if (!box.contains(point(idx))) {
+                    continuous = false;
+                    break;
+                }
             }
         }
 
@@ -219,4 +351,11 @@ Ranges HilbertCurve::query(const Point& a, const Point& b, int max_ranges, int b
     for (const auto& range : ranges) lmtd.add(range);
 
     return lmtd;*/
+}
+
+RangeList HilbertCurve::query(const std::vector<std::pair<Point, Point>>& windows,
+                              uint64_t max_gap) const {
+    RangeList out;
+    for (const auto& [a, b] : windows) out = out | RangeList(query(a, b, 0));
+    return max_gap ? out.coalesce(max_gap) : out;
 }
\ No newline at end of file
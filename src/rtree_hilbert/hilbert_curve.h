@@ -1,4 +1,5 @@
 #pragma once
+#include <utility>
 #include <vector>
 
 #include "ranges.h"
@@ -7,17 +8,29 @@ using ll = long long;
 using Point = std::vector<ll>;
 
 class HilbertCurve {
-    int bits;
+    int bits;  // widest axis
     int dim;
-    ll len;
+    ll len;                      // bits in an index
+    std::vector<int> axis_bits;  // per axis
+    bool compact;                // axes differ in width, keys are compact Hilbert indices
 
    public:
-    HilbertCurve(int bits, int dim) : dim(dim), bits(bits), len(bits * dim) {
+    HilbertCurve(int bits, int dim)
+        : dim(dim), bits(bits), len(bits * dim), axis_bits(dim, bits), compact(false) {
         if (bits < 1 || dim < 1)
             throw std::domain_error("You can't have negative dimensions or bits");
     }
 
+    // Axis i takes axis_bits[i] bits, so each axis only spends key bits on its own range. With
+    // equal widths this is exactly HilbertCurve(bits, dim). Otherwise the key is Hamilton's
+    // compact Hilbert index, a bijection onto sum(axis_bits) bits, which must fit in 63. Its
+    // order is Hamilton's formulation of the Hilbert curve: in 2D that matches the equal-width
+    // curve on the widest axis' square, but in 3 or more dimensions it is a different curve.
+    explicit HilbertCurve(std::vector<int> axis_bits);
+
     [[nodiscard]] ll get_bits() const { return bits; }
+    [[nodiscard]] int get_bits(int axis) const { return axis_bits[axis]; }
+    [[nodiscard]] bool is_compact() const { return compact; }
     [[nodiscard]] ll get_dim() const { return dim; }
     [[nodiscard]] ll get_length() const { return len; }
 
@@ -27,6 +40,7 @@ class HilbertCurve {
 
     void point(ll index, Point& x) const;
 
+    // transpose and to_index are the steps of the equal-width index and ignore per-axis widths
     void transpose(ll indes, Point& x) const;
 
     Point transpose(ll index) const;
@@ -41,6 +55,13 @@ class HilbertCurve {
 
     [[nodiscard]] ll max_index() const;
 
+    // Key ranges covering the box a-b, at most max_ranges of them (0 for all). The list grows as
+    // needed; buffer_size is only checked against max_ranges and no longer caps the result.
     [[nodiscard]] Ranges query(const Point& a, const Point& b, int max_ranges,
                                int buffer_size = 1024) const;
+
+    // Union of the key ranges of several boxes, each given as {low corner, high corner}, with
+    // ranges separated by at most max_gap missing keys joined.
+    [[nodiscard]] RangeList query(const std::vector<std::pair<Point, Point>>& windows,
+                                  uint64_t max_gap = 0) const;
 };
\ No newline at end of file
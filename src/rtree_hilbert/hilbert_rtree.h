@@ -1,17 +1,33 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <climits>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <deque>
 #include <exception>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <random>
 #include <set>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 #include "rtree/rtree.h"
 #include "rtree_hilbert/hilbert_curve.h"
+#include "rtree_hilbert/static_hilbert_curve.h"
 
 using ll = long long;
 using Point = std::vector<ll>;
@@ -21,6 +37,22 @@ namespace hilbert {
 
 const auto not_implemented = std::logic_error("Not implemented"s);
 
+using Timestamp = ll;
+constexpr Timestamp never_expires = LLONG_MAX;
+
+// Per-query cost report; the same counters as for the Gutman tree.
+using QueryStats = Gutman::QueryStats;
+
+// Latency histograms and memory reports are shared with the Gutman tree as well.
+using Gutman::LatencyRecorder;
+using Gutman::MemoryUsage;
+using Gutman::LatencySnapshot;
+using Gutman::Operation;
+
+// Paged searches take and return the same tokens, holding a Hilbert key position here.
+using Gutman::Page;
+using Gutman::PageToken;
+
 struct Rectangle {
     Point lower;
     Point higher;
@@ -64,6 +96,15 @@ struct Rectangle {
         return true;
     }
 
+    bool contains_point(const Point& p) const {
+        for (size_t i = 0; i < lower.size(); ++i) {
+            if (p[i] < lower[i] || higher[i] < p[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
     bool operator==(const Rectangle& other) const {
         if (this->lower.size() != other.lower.size()) {
             throw std::runtime_error("The two rectangles do not have the same dimension.");
@@ -84,7 +125,11 @@ struct Node;
 template <typename T>
 struct NodeEntry {
     virtual ll get_lhv() const = 0;
+    virtual ll get_low_key() const = 0;  // no larger than any key below the entry
     virtual Rectangle& get_mbr() const = 0;
+    virtual Timestamp get_min_expiry() const = 0;
+    virtual size_t get_count() const = 0;
+    virtual double get_max_score() const = 0;
     virtual bool is_leaf() const = 0;
     virtual ~NodeEntry() = default;
 };
@@ -94,8 +139,16 @@ struct LeafEntry : NodeEntry<T> {
     mutable Rectangle mbr;
     T* elem;
     ll lhv;
-    LeafEntry(Rectangle mbr, ll lhv, T* elem) : lhv(lhv), mbr(std::move(mbr)), elem(elem) {}
+    Timestamp expires_at;
+    double score = 0;  // set from the tree's scorer, see RTree::enable_scores()
+    ll sequence = 0;   // insertion number, breaks key ties when paging
+    LeafEntry(Rectangle mbr, ll lhv, T* elem, Timestamp expires_at = never_expires)
+        : lhv(lhv), mbr(std::move(mbr)), elem(elem), expires_at(expires_at) {}
     ll get_lhv() const { return lhv; }
+    ll get_low_key() const { return lhv; }
+    Timestamp get_min_expiry() const { return expires_at; }
+    size_t get_count() const { return 1; }
+    double get_max_score() const { return score; }
     bool is_leaf() const { return true; }
     Rectangle& get_mbr() const { return mbr; }
 };
@@ -108,6 +161,10 @@ struct InnerNode : NodeEntry<T> {
     bool is_leaf() const { return false; }
     Rectangle& get_mbr() const { return node->get_mbr(); }
     ll get_lhv() const { return node->get_lhv(); }
+    ll get_low_key() const { return node->low_key; }
+    Timestamp get_min_expiry() const { return node->min_expiry; }
+    size_t get_count() const { return node->subtree_count; }
+    double get_max_score() const { return node->max_score; }
 };
 
 // FIX: Use proper comparison that prevents duplicate pointers
@@ -138,6 +195,10 @@ struct Node {
     EntrySet<T> entries;  // Changed from EntryMultiSet
     Rectangle mbr;
     ll lhv;
+    ll low_key;            // no larger than any key below this node, see adjust_lhv()
+    Timestamp min_expiry;  // earliest expiry anywhere below this node
+    size_t subtree_count;  // number of leaf entries below this node
+    double max_score;      // best entry score below this node
     int dims;
 
     Node(int min_entries, int max_entries, HilbertCurve& curve)
@@ -150,7 +211,11 @@ struct Node {
           max_entries(max_entries),
           dims(curve.get_dim()),
           mbr(Point(curve.get_dim()), Point(curve.get_dim())),
-          lhv(0) {}
+          lhv(0),
+          low_key(0),
+          min_expiry(never_expires),
+          subtree_count(0),
+          max_score(-std::numeric_limits<double>::infinity()) {}
 
     ~Node() {
         for (auto entry : entries) {
@@ -269,6 +334,9 @@ struct Node {
     }
 
     void adjust_mbr() {
+        min_expiry = never_expires;
+        subtree_count = 0;
+        max_score = -std::numeric_limits<double>::infinity();
         if (entries.empty()) {
             mbr = Rectangle(Point(dims, 0), Point(dims, 0));
             return;
@@ -285,15 +353,20 @@ struct Node {
                 if (rect.higher[i] > hi[i])
                     hi[i] = rect.higher[i];
             }
+            min_expiry = std::min(min_expiry, entry->get_min_expiry());
+            subtree_count += entry->get_count();
+            max_score = std::max(max_score, entry->get_max_score());
         }
         mbr = Rectangle(lo, hi);
     }
 
     void adjust_lhv() {
         lhv = INT64_MIN;
+        low_key = INT64_MAX;
         for (auto& entry : entries) {
             if (entry->get_lhv() > lhv)
                 lhv = entry->get_lhv();
+            low_key = std::min(low_key, entry->get_low_key());
         }
     }
 
@@ -347,29 +420,78 @@ struct Node {
         }
         entries.clear();
         lhv = 0;
+        low_key = 0;
     }
 };
 
-template <typename T>
+// How an entry's rectangle becomes its Hilbert key. Keys hold 63 bits, so the modes that need
+// more than the tree's bits key a coarser grid: the widest axes give up bits together until
+// the key fits, and coordinates are shifted right to match, which keeps the curve's order over
+// the whole declared coordinate range.
+enum class KeyMode {
+    // index of the rectangle's center; rectangles sharing a center share a key
+    center,
+    // index of (lower, higher) on a 2 * dims dimensional curve, so rectangles are ordered by
+    // both position and extent
+    extent,
+    // center index followed by a size class (bit width of the longest side), so rectangles
+    // sharing a center are ordered small to large instead of arbitrarily
+    center_size,
+};
+
+// Curve is the curve keys are taken on: HilbertCurve, or a StaticHilbertCurve<Dim, Bits> for a
+// shape fixed at compile time, which computes the same keys several times faster but only
+// supports KeyMode::center.
+template <typename T, typename Curve = HilbertCurve>
 class RTree {
+    template <typename, typename>
+    friend class RTree;
+
     Node<T>* root;
     int min_entries;
     int max_entries;
     HilbertCurve curve;
+    KeyMode key_mode;
+    std::vector<int> key_shift;    // per axis, coordinates are shifted right before keying
+    Curve key_curve;               // the curve keys are taken on, per key_mode
     std::set<Node<T>*> all_nodes;  // Track all nodes for proper cleanup
+    std::set<Node<T>*> retired;    // Unlinked nodes waiting for release_retired()
+    std::function<double(const T&)> scorer;
+    std::unique_ptr<LatencyRecorder> latency;
+    ll next_sequence = 0;
 
    public:
-    RTree(int min, int max, int dims, int bits)
-        : min_entries(min), max_entries(max), curve(bits, dims), root(nullptr) {}
+    RTree(int min, int max, int dims, int bits, KeyMode key_mode = KeyMode::center)
+        : RTree(min, max, std::vector<int>(dims, bits), key_mode) {}
+
+    // Takes the shape of a StaticHilbertCurve.
+    RTree(int min, int max)
+        requires(!std::is_same_v<Curve, HilbertCurve>)
+        : RTree(min, max, Curve::get_dim(), Curve::get_bits()) {}
+
+    // Per-axis resolution: axis i spans [0, 2^axis_bits[i]), e.g. {24, 8} for a wide spatial
+    // axis and a short time axis. Keys are compact Hilbert indices, see HilbertCurve.
+    RTree(int min, int max, const std::vector<int>& axis_bits, KeyMode key_mode = KeyMode::center)
+        : root(nullptr),
+          min_entries(min),
+          max_entries(max),
+          curve(axis_bits),
+          key_mode(key_mode),
+          key_shift(axis_bits.size()),
+          key_curve(make_curve(key_mode, axis_bits, key_shift)) {}
 
     ~RTree() {
         // Delete all nodes
         for (auto node : all_nodes) {
             delete node;
         }
+        for (auto node : retired) {
+            delete node;
+        }
     }
 
     std::deque<T*> search(const Rectangle& search_rect) {
+        LatencyRecorder::Scope timer(latency.get(), Operation::search);
         std::deque<T*> result;
         if (!root)
             return result;
@@ -377,32 +499,147 @@ class RTree {
         return result;
     }
 
-    void insert(const Rectangle& rect, T* elem) {
-        ll h = curve.index(rect.get_center());
-        if (this->root == nullptr) {
-            this->root = new Node<T>(min_entries, max_entries, curve);
-            all_nodes.insert(root);
-            this->root->set_leaf(true);
-        }
+    // Same as search(), but leaves out entries that have expired by `now`.
+    std::deque<T*> search(const Rectangle& search_rect, Timestamp now) {
+        LatencyRecorder::Scope timer(latency.get(), Operation::search);
+        std::deque<T*> result;
+        if (!root)
+            return result;
+        _search(root, search_rect, result, now);
+        return result;
+    }
 
-        std::deque<Node<T>*> out_siblings;
-        auto* newEntry = new LeafEntry<T>(rect, h, elem);
-        Node<T>* NN = nullptr;
-        Node<T>* L = choose_leaf(this->root, h);
+    // Same as search(), filling in `stats` along the way.
+    std::deque<T*> search(const Rectangle& search_rect, QueryStats& stats) const {
+        auto start = std::chrono::steady_clock::now();
+        std::deque<T*> result;
+        if (root)
+            _explain_search(root, search_rect, 0, result, stats);
+        stats.entries_returned = result.size();
+        stats.elapsed = std::chrono::steady_clock::now() - start;
+        return result;
+    }
 
-        if (L->entries.size() < static_cast<size_t>(max_entries)) {
-            L->insert_leaf_entry(newEntry);
-            L->adjust_lhv();
-            L->adjust_mbr();
-            out_siblings.push_back(L);
-        } else {
-            NN = handle_overflow(L, newEntry, out_siblings);
-        }
+    // Runs search(rect) and reports what it cost: nodes visited per level, rectangle tests,
+    // leaves visited without a match, entries scanned versus returned and elapsed time.
+    QueryStats explain(const Rectangle& search_rect) const {
+        QueryStats stats;
+        search(search_rect, stats);
+        return stats;
+    }
 
-        this->root = adjust_tree(this->root, L, NN, out_siblings);
+    // Up to `limit` entries intersecting search_rect, continuing after `token`. Entries are
+    // paged in order of (Hilbert key, insertion number), a total order that does not depend on
+    // where an entry sits in the tree, and the token holds the last pair returned. Nodes are
+    // expanded smallest key first, skipping those whose keys all lie below the token, so a page
+    // costs about the nodes covering its own key range. Entries left alone between pages are
+    // returned exactly once whatever else is inserted or removed; one removed and inserted
+    // again counts as a new entry.
+    Page<T> search_page(const Rectangle& search_rect, size_t limit,
+                        const PageToken& token = {}) const {
+        if (limit == 0)
+            throw std::invalid_argument("Page limit must be positive");
+        if (!token.done && !token.position.empty() && token.position.size() != 2)
+            throw std::invalid_argument("Not a Hilbert tree page token: " + token.str());
+        Page<T> page;
+        page.next.done = true;
+        if (token.done || !root)
+            return page;
+
+        bool resume = !token.position.empty();
+        PageKey from{LLONG_MIN, LLONG_MIN};
+        if (resume)
+            from = {token.position[0], token.position[1]};
+        auto best = _page(search_rect, limit, resume, from);
+
+        std::vector<std::pair<PageKey, T*>> items;
+        for (; !best.empty(); best.pop()) items.push_back(best.top());
+        std::reverse(items.begin(), items.end());
+
+        for (auto& [key, elem] : items) page.items.push_back(elem);
+        if (items.size() < limit)
+            return page;
+        PageKey last = items.back().first;
+        page.next = PageToken{{last.first, last.second}};
+        return page;
+    }
+
+    // Calls visit(elem, rect) for every entry intersecting search_rect.
+    template <typename Visitor>
+    void visit(const Rectangle& search_rect, Visitor&& visit) const {
+        if (root)
+            _visit(root, search_rect, visit);
+    }
+
+    // Stabbing query: calls visit(elem, rect) for every entry whose rectangle contains `point`.
+    template <typename Visitor>
+    void containing(const Point& point, Visitor&& visit) const {
+        if (root)
+            _containing(root, point, visit);
+    }
+
+    std::deque<T*> containing(const Point& point) const {
+        std::deque<T*> result;
+        containing(point, [&](T* elem, const Rectangle&) { result.push_back(elem); });
+        return result;
+    }
+
+    // Matches a whole batch of points in a single traversal, calling visit(i, elem, rect) for
+    // every entry containing points[i]. The batch is sorted by the tree's own Hilbert key, so
+    // nearby points share the same descent; the subset of points reaching a node is narrowed
+    // child by child instead of restarting from the root for each point.
+    template <typename Visitor>
+    void containing_batch(const std::vector<Point>& points, Visitor&& visit) const {
+        if (!root || points.empty())
+            return;
+        std::vector<ll> keys(points.size());
+        std::vector<size_t> order(points.size());
+        for (size_t i = 0; i < points.size(); i++) {
+            keys[i] = key(Rectangle(points[i], points[i]));
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(),
+                  [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+
+        size_t height = 1;
+        for (auto n = root; !n->is_leaf();) {
+            n = static_cast<InnerNode<T>*>(*n->entries.begin())->node;
+            height++;
+        }
+        std::vector<std::vector<size_t>> scratch(height);
+        _containing_batch(root, order, 0, points, scratch, visit);
+    }
+
+    KeyMode get_key_mode() const { return key_mode; }
+
+    // The Hilbert key insert() gives `rect` under this tree's KeyMode.
+    ll key(const Rectangle& rect) const {
+        if (key_mode == KeyMode::center)
+            return key_curve.index(rect.get_center());
+        Point p;
+        if (key_mode == KeyMode::extent) {
+            size_t dims = rect.lower.size();
+            for (size_t i = 0; i < dims; i++) p.push_back(rect.lower[i] >> key_shift[i]);
+            for (size_t i = 0; i < dims; i++) p.push_back(rect.higher[i] >> key_shift[i]);
+            return key_curve.index(p);
+        }
+        ll longest = 0;
+        for (size_t i = 0; i < rect.lower.size(); i++)
+            longest = std::max(longest, rect.higher[i] - rect.lower[i]);
+        ll size_class = 0;
+        for (; longest > 0 && size_class < 63; longest >>= 1) size_class++;
+        p = rect.get_center();
+        for (size_t i = 0; i < p.size(); i++) p[i] >>= key_shift[i];
+        return (key_curve.index(p) << 6) | size_class;
+    }
+
+    void insert(const Rectangle& rect, T* elem, Timestamp expires_at = never_expires) {
+        LatencyRecorder::Scope timer(latency.get(), Operation::insert);
+        insert_entry(make_leaf(rect, elem, expires_at));
     }
 
     void remove(const Rectangle& rect) {
+        LatencyRecorder::Scope timer(latency.get(), Operation::remove);
         if (!root)
             return;
 
@@ -418,10 +655,658 @@ class RTree {
             }
 
             condense_tree(L, DL, out_siblings);
+            refresh_ancestors(L, out_siblings);
+            release_retired();
+        }
+    }
+
+    // Moves the entry stored under `current` to `desired`, now holding `new_elem`. The entry
+    // keeps its expiry, and its score too while the payload stays the same.
+    void update(const Rectangle& current, const Rectangle& desired, T* new_elem) {
+        LatencyRecorder::Scope timer(latency.get(), Operation::update);
+        auto moved = make_leaf(desired, new_elem, never_expires);
+        if (auto L = exactSearch(root, current)) {
+            for (auto entry : L->entries) {
+                auto leaf = static_cast<LeafEntry<T>*>(entry);
+                if (leaf->mbr == current) {
+                    moved->expires_at = leaf->expires_at;
+                    if (leaf->elem == new_elem)
+                        moved->score = leaf->score;
+                    break;
+                }
+            }
+        }
+        remove(current);
+        insert_entry(moved);
+    }
+
+    // Removes every entry overlapping `window` for which pred(elem, rect) holds.
+    // The affected region is walked once; nodes left underfull are dissolved and
+    // their remaining entries reinserted afterwards. Returns the number removed.
+    template <typename Pred>
+    size_t remove_if(const Rectangle& window, Pred pred) {
+        return bulk_remove([&](const Node<T>* n) { return n->mbr.intersects(window); },
+                           [&](const LeafEntry<T>* e) {
+                               return e->mbr.intersects(window) && pred(e->elem, e->mbr);
+                           });
+    }
+
+    // Removes every entry whose expiry time is <= t, descending only into
+    // nodes whose earliest expiry is <= t. Returns the number removed.
+    size_t expire_until(Timestamp t) {
+        if (!root || root->min_expiry > t)
+            return 0;
+        return bulk_remove([t](const Node<T>* n) { return n->min_expiry <= t; },
+                           [t](const LeafEntry<T>* e) { return e->expires_at <= t; });
+    }
+
+    // Approximate number of entries intersecting `rect`, for query planning. Subtrees fully
+    // inside `rect` contribute their entry count, leaves are counted exactly, and after
+    // `levels` levels a partially covered subtree contributes its count scaled by the
+    // fraction of its MBR that `rect` covers (assuming entries are spread uniformly).
+    double estimate_count(const Rectangle& rect, int levels = 2) const {
+        if (!root)
+            return 0;
+        return _estimate_count(root, rect, levels);
+    }
+
+    // Returns min(k, matches) distinct entries intersecting `rect`, chosen uniformly at random
+    // without enumerating the window. Each draw descends from the root, picking among the
+    // intersecting children in proportion to their subtree counts; below the root the draw
+    // survives a node n with probability S(n) / count(n), S(n) being the count held by its
+    // intersecting children, and the entry picked at the leaf must itself intersect. That
+    // makes every entry in the window equally likely. Small windows are enumerated instead.
+    template <typename Rng>
+    std::deque<T*> sample(const Rectangle& rect, size_t k, Rng& rng) const {
+        std::deque<T*> result;
+        if (!root || k == 0)
+            return result;
+        if (2 * k >= estimate_count(rect))
+            return sample_enumerated(rect, k, rng);
+
+        std::unordered_set<const LeafEntry<T>*> seen;
+        for (size_t attempts = 0; result.size() < k; attempts++) {
+            // the estimate was off, or the window is mostly made of rejected boundary nodes
+            if (attempts == 64 * k)
+                return sample_enumerated(rect, k, rng);
+            auto entry = draw(rect, rng);
+            if (entry && seen.insert(entry).second)
+                result.push_back(entry->elem);
         }
+        return result;
+    }
+
+    // Scores every entry with score(*elem) and keeps the best score of each subtree up to date,
+    // which top_k() needs. Scores are taken at insertion time; calling this again rescores the
+    // whole tree, e.g. after payloads changed.
+    void enable_scores(std::function<double(const T&)> score) {
+        scorer = std::move(score);
+        if (root)
+            rescore(root);
     }
 
+    // The k highest scoring entries intersecting `rect`, best first. Nodes are expanded in
+    // order of their best score, so the search stops as soon as k entries beat every subtree
+    // still waiting in the queue.
+    std::deque<T*> top_k(const Rectangle& rect, size_t k) const {
+        if (!scorer)
+            throw std::logic_error("top_k() needs enable_scores() first");
+        std::deque<T*> result;
+        if (!root || k == 0)
+            return result;
+
+        struct Candidate {
+            double bound;
+            const NodeEntry<T>* entry;
+            bool operator<(const Candidate& other) const { return bound < other.bound; }
+        };
+        auto expand = [&](const Node<T>* node, std::priority_queue<Candidate>& queue) {
+            for (auto entry : node->entries) {
+                if (entry->get_mbr().intersects(rect))
+                    queue.push({entry->get_max_score(), entry});
+            }
+        };
+        std::priority_queue<Candidate> queue;
+        expand(root, queue);
+        while (!queue.empty() && result.size() < k) {
+            auto top = queue.top();
+            queue.pop();
+            if (top.entry->is_leaf())
+                result.push_back(static_cast<const LeafEntry<T>*>(top.entry)->elem);
+            else
+                expand(static_cast<const InnerNode<T>*>(top.entry)->node, queue);
+        }
+        return result;
+    }
+
+    // Neighbour lists as returned by the kNN queries, closest first.
+    using Neighbours = std::deque<T*>;
+
+    // The k entries nearest to `point`, measured to the closest point of their rectangles.
+    Neighbours nearest(const Point& point, size_t k) const {
+        LatencyRecorder::Scope timer(latency.get(), Operation::knn);
+        if (!root || k == 0)
+            return {};
+        Rectangle query(point, point);
+        std::vector<Neighbours> found(1);
+        knn_group({{&query, nullptr}}, k, found);
+        return found[0];
+    }
+
+    // Same as nearest(), filling in `stats` along the way.
+    Neighbours nearest(const Point& point, size_t k, QueryStats& stats) const {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<Neighbours> found(1);
+        if (root && k > 0) {
+            Rectangle query(point, point);
+            knn_group({{&query, nullptr}}, k, found, &stats);
+        }
+        stats.entries_returned = found[0].size();
+        stats.elapsed = std::chrono::steady_clock::now() - start;
+        return found[0];
+    }
+
+    // Runs nearest(point, k) and reports what it cost, as explain() does for window searches.
+    // A leaf counts as a false positive when none of its entries made the candidate list.
+    QueryStats explain_nearest(const Point& point, size_t k) const {
+        QueryStats stats;
+        nearest(point, k, stats);
+        return stats;
+    }
+
+    // The k nearest neighbours of every entry in the tree (an entry is not its own neighbour),
+    // as (entry, neighbours) pairs. Each leaf is one batch: a single best-first traversal,
+    // pruned by the worst k-th distance in the batch, serves all of its entries. Leaves are
+    // taken in the tree's Hilbert order so consecutive batches touch mostly the same nodes,
+    // and are spread over `threads` workers. The tree must not change while this runs.
+    std::vector<std::pair<T*, Neighbours>> knn_all(size_t k,
+                                                   unsigned threads = default_threads()) const {
+        std::vector<std::pair<T*, Neighbours>> result;
+        if (!root || k == 0)
+            return result;
+        std::vector<const Node<T>*> leaves;
+        collect_leaves(root, leaves);
+
+        std::vector<size_t> offset(leaves.size() + 1, 0);
+        for (size_t i = 0; i < leaves.size(); i++)
+            offset[i + 1] = offset[i] + leaves[i]->entries.size();
+        result.resize(offset.back());
+
+        parallel_for(leaves.size(), threads, [&](size_t i) {
+            std::vector<KnnQuery> queries;
+            for (auto entry : leaves[i]->entries) {
+                auto* leaf = static_cast<const LeafEntry<T>*>(entry);
+                queries.push_back({&leaf->mbr, leaf});
+            }
+            std::vector<Neighbours> found(queries.size());
+            knn_group(queries, k, found);
+            for (size_t j = 0; j < queries.size(); j++)
+                result[offset[i] + j] = {queries[j].self->elem, std::move(found[j])};
+        });
+        return result;
+    }
+
+    // The k nearest entries of every point in `points`, in the same order as `points`. The
+    // points are sorted by Hilbert key and handled in batches of max_entries, as in knn_all(k).
+    std::vector<Neighbours> knn_all(const std::vector<Point>& points, size_t k,
+                                    unsigned threads = default_threads()) const {
+        std::vector<Neighbours> result(points.size());
+        if (!root || k == 0 || points.empty())
+            return result;
+        std::vector<ll> keys(points.size());
+        std::vector<size_t> order(points.size());
+        std::vector<Rectangle> rects;
+        for (size_t i = 0; i < points.size(); i++) {
+            keys[i] = key(Rectangle(points[i], points[i]));
+            order[i] = i;
+            rects.emplace_back(points[i], points[i]);
+        }
+        std::sort(order.begin(), order.end(),
+                  [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+
+        size_t batch = max_entries;
+        parallel_for((points.size() + batch - 1) / batch, threads, [&](size_t b) {
+            size_t begin = b * batch, end = std::min(points.size(), begin + batch);
+            std::vector<KnnQuery> queries;
+            for (size_t i = begin; i < end; i++) queries.push_back({&rects[order[i]], nullptr});
+            std::vector<Neighbours> found(queries.size());
+            knn_group(queries, k, found);
+            for (size_t i = begin; i < end; i++) result[order[i]] = std::move(found[i - begin]);
+        });
+        return result;
+    }
+
+    // Calls visit(a, b) once for every unordered pair of distinct entries whose rectangles are
+    // within distance eps of each other. The tree is traversed against itself, descending only
+    // into node pairs whose MBRs are within eps; a node paired with itself visits each pair of
+    // its children once, which skips the symmetric duplicates. With threads > 1 the top node
+    // pairs are split among workers and visit is called concurrently, so it has to be
+    // thread-safe in that case.
+    template <typename Visitor>
+    void self_join_within(double eps, Visitor&& visit, unsigned threads = 1) const {
+        if (!root)
+            return;
+        double eps2 = eps * eps;
+        using NodePair = std::pair<const Node<T>*, const Node<T>*>;
+        std::vector<NodePair> tasks{{root, root}};
+        while (threads > 1 && tasks.size() < 16 * threads && !tasks.front().first->is_leaf()) {
+            std::vector<NodePair> next;
+            for (auto [a, b] : tasks)
+                for_each_close_pair(a, b, eps2, [&](auto x, auto y) { next.push_back({x, y}); });
+            tasks = std::move(next);
+            if (tasks.empty())
+                return;
+        }
+        parallel_for(tasks.size(), threads,
+                     [&](size_t i) { _self_join(tasks[i].first, tasks[i].second, eps2, visit); });
+    }
+
+    // The k closest (this entry, other entry, distance) pairs between this tree and `other`,
+    // closest first. Node pairs are expanded best-first by the MINDIST of their MBRs. Every
+    // queued pair also promises count_a * count_b entry pairs no farther apart than its
+    // MAXDIST, so once the queue promises k pairs within some distance, new node pairs whose
+    // MINDIST is beyond it are dropped instead of queued.
+    template <typename U, typename OtherCurve>
+    std::vector<std::tuple<T*, U*, double>> closest_pairs(const RTree<U, OtherCurve>& other,
+                                                          size_t k) const {
+        std::vector<std::tuple<T*, U*, double>> result;
+        if (!root || !other.root || k == 0)
+            return result;
+
+        // Upper bounds on the k-th distance, kept as for Gutman::RTree::closest_pairs().
+        using Promise = std::tuple<double, size_t, size_t>;  // (MAXDIST, id, entry pairs)
+        std::set<Promise> promises;
+        size_t promised = 0, next_promise = 0;
+        std::priority_queue<double> nearest_k;
+        double bound = std::numeric_limits<double>::infinity();
+
+        struct Pending {
+            double mindist;
+            size_t pairs;  // entry pairs covered; on equal MINDIST the finer pair goes first
+            const Node<T>* a;
+            const Node<U>* b;
+            const LeafEntry<T>* entry_a;
+            const LeafEntry<U>* entry_b;
+            Promise promise;
+            bool operator>(const Pending& other) const {
+                return mindist != other.mindist ? mindist > other.mindist : pairs > other.pairs;
+            }
+        };
+        std::priority_queue<Pending, std::vector<Pending>, std::greater<>> queue;
+
+        auto add_nodes = [&](const Node<T>* a, const Node<U>* b) {
+            double mindist = min_dist(a->mbr, b->mbr);
+            if (mindist > bound)
+                return;
+            size_t pairs = a->subtree_count * b->subtree_count;
+            Promise promise{max_dist(a->mbr, b->mbr), next_promise++, pairs};
+            if (std::get<0>(promise) < bound) {
+                promises.insert(promise);
+                promised += pairs;
+            }
+            queue.push({mindist, pairs, a, b, nullptr, nullptr, promise});
+        };
+        auto add_entries = [&](const LeafEntry<T>* x, const LeafEntry<U>* y) {
+            double d = min_dist(x->mbr, y->mbr);
+            if (d > bound)
+                return;
+            queue.push({d, 1, nullptr, nullptr, x, y, {}});
+            nearest_k.push(d);
+            if (nearest_k.size() > k)
+                nearest_k.pop();
+            if (nearest_k.size() == k)
+                bound = std::min(bound, nearest_k.top());
+        };
+        auto tighten = [&] {
+            while (!promises.empty()) {
+                auto [maxdist, id, count] = *promises.rbegin();
+                if (maxdist < bound && promised - count < k) {
+                    if (promised >= k)
+                        bound = maxdist;
+                    return;
+                }
+                promised -= count;
+                promises.erase(std::prev(promises.end()));
+            }
+        };
+
+        add_nodes(root, other.root);
+        while (!queue.empty() && result.size() < k) {
+            auto top = queue.top();
+            queue.pop();
+            if (top.entry_a) {
+                result.emplace_back(top.entry_a->elem, top.entry_b->elem, std::sqrt(top.mindist));
+                continue;
+            }
+            if (promises.erase(top.promise))
+                promised -= top.pairs;
+            // expand one side at a time, the larger one unless it is already a leaf
+            if (top.a->is_leaf() && top.b->is_leaf()) {
+                for (auto x : top.a->entries) {
+                    for (auto y : top.b->entries) {
+                        add_entries(static_cast<const LeafEntry<T>*>(x),
+                                    static_cast<const LeafEntry<U>*>(y));
+                    }
+                }
+            } else if (top.b->is_leaf() ||
+                       (!top.a->is_leaf() && volume(top.a->mbr) >= volume(top.b->mbr))) {
+                for (auto node : child_nodes(top.a)) add_nodes(node, top.b);
+            } else {
+                for (auto node : child_nodes(top.b)) add_nodes(top.a, node);
+            }
+            tighten();
+        }
+        return result;
+    }
+
+    // Bytes held by the tree's nodes, entries, rectangles and containers, plus modelled
+    // allocator overhead. Nodes unlinked but not yet released are included; payloads are not.
+    MemoryUsage memory_usage() const {
+        // a std::set node is a colour word and three links followed by the value
+        constexpr size_t set_node = 4 * sizeof(void*) + sizeof(void*);
+        MemoryUsage usage;
+        auto rect = [&](const Rectangle& r) {
+            usage.rectangles += usage.heap(r.lower.capacity() * sizeof(ll)) +
+                                usage.heap(r.higher.capacity() * sizeof(ll));
+        };
+        for (auto* nodes : {&all_nodes, &retired}) {
+            for (auto node : *nodes) {
+                usage.containers += usage.heap(set_node);  // the tree's own bookkeeping
+                usage.nodes += usage.heap(sizeof(Node<T>));
+                rect(node->mbr);
+                for (auto entry : node->entries) {
+                    usage.containers += usage.heap(set_node);
+                    if (entry->is_leaf()) {
+                        usage.entries += usage.heap(sizeof(LeafEntry<T>));
+                        rect(entry->get_mbr());
+                        usage.entry_count++;
+                    } else {
+                        usage.nodes += usage.heap(sizeof(InnerNode<T>));
+                    }
+                }
+            }
+        }
+        return usage;
+    }
+
+    // Starts recording the latency of every insert, remove, update, search and nearest call in
+    // per-operation histograms; off by default. Calling it again clears what was recorded.
+    void enable_latency_histograms() {
+        if (latency)
+            latency->reset();
+        else
+            latency = std::make_unique<LatencyRecorder>();
+    }
+
+    // What has been recorded for `op` so far, merged over all threads; empty while off.
+    LatencySnapshot latency_histogram(Operation op) const {
+        return latency ? latency->snapshot(op) : LatencySnapshot();
+    }
+
+    static unsigned default_threads() { return std::max(1u, std::thread::hardware_concurrency()); }
+
    private:
+    // The key curve for `mode`, filling in how far each axis is shifted onto it. Center mode
+    // keeps the tree's own bits; the others lower the widest axes together until their extra
+    // information fits into the 63 bits of a key.
+    static HilbertCurve make_key_curve(KeyMode mode, const std::vector<int>& axis_bits,
+                                       std::vector<int>& shift) {
+        if (mode == KeyMode::center)
+            return HilbertCurve(axis_bits);
+        auto bits = axis_bits;
+        int copies = mode == KeyMode::extent ? 2 : 1;
+        int budget = mode == KeyMode::extent ? 63 : 63 - 6;
+        auto total = [&] {
+            int sum = 0;
+            for (auto b : bits) sum += copies * b;
+            return sum;
+        };
+        while (total() > budget) {
+            int widest = *std::max_element(bits.begin(), bits.end());
+            if (widest == 1)
+                break;
+            for (auto& b : bits) b = std::min(b, widest - 1);
+        }
+        for (size_t i = 0; i < bits.size(); i++) shift[i] = axis_bits[i] - bits[i];
+        if (mode == KeyMode::extent) {
+            auto lower = bits;
+            bits.insert(bits.end(), lower.begin(), lower.end());
+        }
+        return HilbertCurve(bits);
+    }
+
+    // A static curve has no shifts and fixes the shape, which must match the tree's.
+    static Curve make_curve(KeyMode mode, const std::vector<int>& axis_bits,
+                            std::vector<int>& shift) {
+        if constexpr (std::is_same_v<Curve, HilbertCurve>) {
+            return make_key_curve(mode, axis_bits, shift);
+        } else {
+            if (mode != KeyMode::center ||
+                axis_bits != std::vector<int>(Curve::get_dim(), Curve::get_bits()))
+                throw std::invalid_argument("The tree's shape does not match its static curve");
+            return Curve{};
+        }
+    }
+
+    struct KnnQuery {
+        const Rectangle* rect;
+        const LeafEntry<T>* self;  // excluded from its own neighbours
+    };
+
+    // Best-first kNN search for a batch of queries sharing one traversal. Nodes are visited in
+    // order of their distance to the MBR of the whole batch until none can improve any query's
+    // current k-th distance; leaves are skipped per query using that query's own bound.
+    void knn_group(const std::vector<KnnQuery>& queries, size_t k, std::vector<Neighbours>& found,
+                   QueryStats* stats = nullptr) const {
+        using Candidate = std::pair<double, T*>;
+        std::vector<std::priority_queue<Candidate>> best(queries.size());
+        auto bound = [&](size_t q) {
+            if (best[q].size() < k)
+                return std::numeric_limits<double>::infinity();
+            return best[q].top().first;
+        };
+
+        Point lo = queries[0].rect->lower, hi = queries[0].rect->higher;
+        for (auto& query : queries) {
+            for (size_t i = 0; i < lo.size(); i++) {
+                lo[i] = std::min(lo[i], query.rect->lower[i]);
+                hi[i] = std::max(hi[i], query.rect->higher[i]);
+            }
+        }
+        Rectangle group(lo, hi);
+
+        // (distance to the batch, node, level)
+        using Pending = std::tuple<double, const Node<T>*, size_t>;
+        std::priority_queue<Pending, std::vector<Pending>, std::greater<>> frontier;
+        frontier.push({min_dist(root->mbr, group), root, 0});
+        while (!frontier.empty()) {
+            auto [dist, node, level] = frontier.top();
+            frontier.pop();
+            double worst = 0;
+            for (size_t q = 0; q < queries.size(); q++) worst = std::max(worst, bound(q));
+            if (dist > worst)
+                break;
+            if (stats)
+                stats->visit_node(level);
+            if (!node->is_leaf()) {
+                for (auto entry : node->entries) {
+                    auto* child = static_cast<const InnerNode<T>*>(entry)->node;
+                    frontier.push({min_dist(child->mbr, group), child, level + 1});
+                }
+                if (stats)
+                    stats->mbr_tests += node->entries.size();
+                continue;
+            }
+            bool contributed = false;
+            for (size_t q = 0; q < queries.size(); q++) {
+                if (stats)
+                    stats->mbr_tests++;
+                if (min_dist(node->mbr, *queries[q].rect) > bound(q))
+                    continue;
+                if (stats) {
+                    stats->mbr_tests += node->entries.size();
+                    stats->entries_scanned += node->entries.size();
+                }
+                for (auto entry : node->entries) {
+                    auto* leaf = static_cast<const LeafEntry<T>*>(entry);
+                    if (leaf == queries[q].self)
+                        continue;
+                    double d = min_dist(leaf->mbr, *queries[q].rect);
+                    if (best[q].size() < k) {
+                        best[q].push({d, leaf->elem});
+                        contributed = true;
+                    } else if (d < best[q].top().first) {
+                        best[q].pop();
+                        best[q].push({d, leaf->elem});
+                        contributed = true;
+                    }
+                }
+            }
+            if (stats && !contributed)
+                stats->false_positive_leaves++;
+        }
+
+        for (size_t q = 0; q < queries.size(); q++) {
+            found[q].resize(best[q].size());
+            for (size_t i = found[q].size(); i-- > 0; best[q].pop())
+                found[q][i] = best[q].top().second;
+        }
+    }
+
+    template <typename Visitor>
+    void _self_join(const Node<T>* a, const Node<T>* b, double eps2, Visitor& visit) const {
+        if (!a->is_leaf()) {
+            for_each_close_pair(a, b, eps2,
+                                [&](auto x, auto y) { _self_join(x, y, eps2, visit); });
+            return;
+        }
+        for (auto i = a->entries.begin(); i != a->entries.end(); ++i) {
+            auto* x = static_cast<const LeafEntry<T>*>(*i);
+            auto j = a == b ? std::next(i) : b->entries.begin();
+            for (; j != b->entries.end(); ++j) {
+                auto* y = static_cast<const LeafEntry<T>*>(*j);
+                if (min_dist(x->mbr, y->mbr) <= eps2)
+                    visit(x->elem, y->elem);
+            }
+        }
+    }
+
+    // Calls fn on every pair of children of a and b whose MBRs are within the distance,
+    // taking each unordered pair once when a == b.
+    template <typename Fn>
+    static void for_each_close_pair(const Node<T>* a, const Node<T>* b, double eps2, Fn fn) {
+        for (auto i = a->entries.begin(); i != a->entries.end(); ++i) {
+            auto* x = static_cast<const InnerNode<T>*>(*i)->node;
+            for (auto j = (a == b ? i : b->entries.begin()); j != b->entries.end(); ++j) {
+                auto* y = static_cast<const InnerNode<T>*>(*j)->node;
+                if (min_dist(x->mbr, y->mbr) <= eps2)
+                    fn(x, y);
+            }
+        }
+    }
+
+    static double volume(const Rectangle& r) {
+        double v = 1;
+        for (size_t i = 0; i < r.lower.size(); i++) v *= double(r.higher[i] - r.lower[i] + 1);
+        return v;
+    }
+
+    template <typename U>
+    static std::vector<const Node<U>*> child_nodes(const Node<U>* node) {
+        std::vector<const Node<U>*> nodes;
+        for (auto entry : node->entries)
+            nodes.push_back(static_cast<const InnerNode<U>*>(entry)->node);
+        return nodes;
+    }
+
+    // Squared distance between the farthest points of two rectangles.
+    static double max_dist(const Rectangle& a, const Rectangle& b) {
+        double sum = 0;
+        for (size_t i = 0; i < a.lower.size(); i++) {
+            double span = std::max(a.higher[i] - b.lower[i], b.higher[i] - a.lower[i]);
+            sum += span * span;
+        }
+        return sum;
+    }
+
+    // Squared distance between the closest points of two rectangles.
+    static double min_dist(const Rectangle& a, const Rectangle& b) {
+        double sum = 0;
+        for (size_t i = 0; i < a.lower.size(); i++) {
+            double gap = std::max({ll(0), a.lower[i] - b.higher[i], b.lower[i] - a.higher[i]});
+            sum += gap * gap;
+        }
+        return sum;
+    }
+
+    static void collect_leaves(const Node<T>* node, std::vector<const Node<T>*>& leaves) {
+        if (node->is_leaf()) {
+            if (!node->entries.empty())
+                leaves.push_back(node);
+            return;
+        }
+        for (auto entry : node->entries)
+            collect_leaves(static_cast<const InnerNode<T>*>(entry)->node, leaves);
+    }
+
+    // Runs fn(0) ... fn(n - 1) on up to `threads` threads, handing out indices in order.
+    template <typename Fn>
+    static void parallel_for(size_t n, unsigned threads, Fn fn) {
+        threads = std::max(1u, (unsigned)std::min<size_t>(threads, n));
+        std::atomic<size_t> next{0};
+        auto worker = [&] {
+            for (size_t i; (i = next++) < n;) fn(i);
+        };
+        std::vector<std::thread> pool;
+        for (unsigned t = 1; t < threads; t++) pool.emplace_back(worker);
+        worker();
+        for (auto& thread : pool) thread.join();
+    }
+
+    void rescore(Node<T>* node) {
+        for (auto entry : node->entries) {
+            if (entry->is_leaf()) {
+                auto leaf = static_cast<LeafEntry<T>*>(entry);
+                leaf->score = scorer(*leaf->elem);
+            } else {
+                rescore(static_cast<InnerNode<T>*>(entry)->node);
+            }
+        }
+        node->adjust_mbr();
+    }
+
+    LeafEntry<T>* make_leaf(const Rectangle& rect, T* elem, Timestamp expires_at) {
+        auto entry = new LeafEntry<T>(rect, key(rect), elem, expires_at);
+        if (scorer)
+            entry->score = scorer(*elem);
+        entry->sequence = next_sequence++;
+        return entry;
+    }
+
+    void insert_entry(LeafEntry<T>* newEntry) {
+        ll h = newEntry->get_lhv();
+        if (this->root == nullptr) {
+            this->root = new Node<T>(min_entries, max_entries, curve);
+            all_nodes.insert(root);
+            this->root->set_leaf(true);
+        }
+
+        std::deque<Node<T>*> out_siblings;
+        Node<T>* NN = nullptr;
+        Node<T>* L = choose_leaf(this->root, h);
+
+        if (L->entries.size() < static_cast<size_t>(max_entries)) {
+            L->insert_leaf_entry(newEntry);
+            L->adjust_lhv();
+            L->adjust_mbr();
+            out_siblings.push_back(L);
+        } else {
+            NN = handle_overflow(L, newEntry, out_siblings);
+        }
+
+        this->root = adjust_tree(this->root, L, NN, out_siblings);
+    }
+
     Node<T>* choose_leaf(Node<T>* node, ll hilbert_value) {
         if (node->is_leaf()) {
             return node;
@@ -904,9 +1789,8 @@ class RTree {
                                 validate_and_fix_child_chain(node);
                             }
 
-                            all_nodes.erase(main_node);
                             delete main_entry;
-                            delete main_node;
+                            retire_node(main_node);
                         }
                     }
                 }
@@ -955,14 +1839,8 @@ class RTree {
                     del_node->set_prev_siblings(nullptr);
                     del_node->set_next_siblings(nullptr);
 
-                    // Delete the node if it still exists
-                    // (handle_underflow may have already erased it from all_nodes)
-                    if (node_exists && all_nodes.find(del_node) != all_nodes.end()) {
-                        all_nodes.erase(del_node);
-                    }
-
-                    // Always safe to delete - either it's still valid or already erased
-                    delete del_node;
+                    // Freed at the end of the removal, once no sibling link can reach it
+                    retire_node(del_node);
                     del_node = nullptr;
                 }
 
@@ -1030,7 +1908,8 @@ class RTree {
         return nullptr;
     }
 
-    void _search(Node<T>* subtree, const Rectangle& rect, std::deque<T*>& result) {
+    void _search(Node<T>* subtree, const Rectangle& rect, std::deque<T*>& result,
+                 Timestamp now = LLONG_MIN) {
         if (!subtree)
             return;
 
@@ -1041,7 +1920,7 @@ class RTree {
             for (; it != end; ++it) {
                 auto* entry = static_cast<LeafEntry<T>*>(*it);
 
-                if (entry->mbr.intersects(rect)) {
+                if (entry->expires_at > now && entry->mbr.intersects(rect)) {
                     result.push_back(entry->elem);
                 }
             }
@@ -1050,11 +1929,372 @@ class RTree {
                 auto* inner = static_cast<InnerNode<T>*>(*it);
 
                 if (inner->node && inner->node->mbr.intersects(rect)) {
-                    _search(inner->node, rect, result);
+                    _search(inner->node, rect, result, now);
+                }
+            }
+        }
+    }
+
+    void _explain_search(const Node<T>* subtree, const Rectangle& rect, size_t level,
+                         std::deque<T*>& result, QueryStats& stats) const {
+        stats.visit_node(level);
+        stats.mbr_tests += subtree->entries.size();
+        if (subtree->is_leaf()) {
+            size_t before = result.size();
+            stats.entries_scanned += subtree->entries.size();
+            for (auto entry : subtree->entries) {
+                auto* leaf = static_cast<const LeafEntry<T>*>(entry);
+                if (leaf->mbr.intersects(rect))
+                    result.push_back(leaf->elem);
+            }
+            if (result.size() == before)
+                stats.false_positive_leaves++;
+            return;
+        }
+        for (auto entry : subtree->entries) {
+            auto* child = static_cast<const InnerNode<T>*>(entry)->node;
+            if (child->mbr.intersects(rect))
+                _explain_search(child, rect, level + 1, result, stats);
+        }
+    }
+
+    // Paging order of an entry: its key, then its insertion number.
+    using PageKey = std::pair<ll, ll>;
+    using PageBest = std::priority_queue<std::pair<PageKey, T*>>;  // worst on top
+
+    // The `limit` smallest entries after `from`, best-first over the nodes by their smallest
+    // key: a node is expanded only while it could still hold one of them.
+    PageBest _page(const Rectangle& rect, size_t limit, bool resume, PageKey from) const {
+        PageBest best;
+        using Pending = std::pair<ll, const Node<T>*>;
+        std::priority_queue<Pending, std::vector<Pending>, std::greater<Pending>> nodes;
+        nodes.push({root->low_key, root});
+        while (!nodes.empty()) {
+            auto [low, node] = nodes.top();
+            if (best.size() == limit && low > best.top().first.first)
+                break;
+            nodes.pop();
+            for (auto entry : node->entries) {
+                if (entry->get_lhv() < from.first || !entry->get_mbr().intersects(rect))
+                    continue;
+                if (!node->is_leaf()) {
+                    nodes.push({entry->get_low_key(), static_cast<InnerNode<T>*>(entry)->node});
+                    continue;
+                }
+                auto* leaf = static_cast<const LeafEntry<T>*>(entry);
+                PageKey key{leaf->lhv, leaf->sequence};
+                if (resume && key <= from)
+                    continue;
+                if (best.size() < limit) {
+                    best.push({key, leaf->elem});
+                } else if (key < best.top().first) {
+                    best.pop();
+                    best.push({key, leaf->elem});
                 }
             }
         }
+        return best;
+    }
+
+    template <typename Visitor>
+    void _visit(const Node<T>* subtree, const Rectangle& rect, Visitor& visit) const {
+        if (subtree->is_leaf()) {
+            for (auto entry : subtree->entries) {
+                auto* leaf = static_cast<const LeafEntry<T>*>(entry);
+                if (leaf->mbr.intersects(rect))
+                    visit(leaf->elem, leaf->mbr);
+            }
+            return;
+        }
+        for (auto entry : subtree->entries) {
+            auto* child = static_cast<const InnerNode<T>*>(entry)->node;
+            if (child->mbr.intersects(rect))
+                _visit(child, rect, visit);
+        }
+    }
+
+    // condense_tree() only adjusts the nodes it restructures, so after a removal the
+    // aggregates (subtree counts, MBRs) of the nodes above the touched leaves are recomputed
+    // level by level up to the root.
+    void refresh_ancestors(Node<T>* leaf, const std::deque<Node<T>*>& siblings) {
+        std::set<Node<T>*> level;
+        for (auto node : siblings) {
+            if (all_nodes.count(node))
+                level.insert(node);
+        }
+        if (all_nodes.count(leaf))
+            level.insert(leaf);
+        while (!level.empty()) {
+            std::set<Node<T>*> parents;
+            for (auto node : level) {
+                node->adjust_mbr();
+                if (node->get_parent())
+                    parents.insert(node->get_parent());
+            }
+            level = std::move(parents);
+        }
+    }
+
+    // One attempt of the rejection descent used by sample(); nullptr when rejected.
+    template <typename Rng>
+    const LeafEntry<T>* draw(const Rectangle& rect, Rng& rng) const {
+        const Node<T>* node = root;
+        while (!node->is_leaf()) {
+            size_t total = 0;
+            for (auto entry : node->entries) {
+                if (entry->get_mbr().intersects(rect))
+                    total += entry->get_count();
+            }
+            if (total == 0)
+                return nullptr;
+            if (node != root &&
+                std::uniform_int_distribution<size_t>(1, node->subtree_count)(rng) > total)
+                return nullptr;
+            size_t pick = std::uniform_int_distribution<size_t>(0, total - 1)(rng);
+            for (auto entry : node->entries) {
+                if (!entry->get_mbr().intersects(rect))
+                    continue;
+                if (pick < entry->get_count()) {
+                    node = static_cast<const InnerNode<T>*>(entry)->node;
+                    break;
+                }
+                pick -= entry->get_count();
+            }
+        }
+        if (node->entries.empty())
+            return nullptr;
+        auto pick = std::uniform_int_distribution<size_t>(0, node->entries.size() - 1)(rng);
+        auto* leaf = static_cast<const LeafEntry<T>*>(*std::next(node->entries.begin(), pick));
+        return leaf->mbr.intersects(rect) ? leaf : nullptr;
+    }
+
+    template <typename Rng>
+    std::deque<T*> sample_enumerated(const Rectangle& rect, size_t k, Rng& rng) const {
+        std::vector<T*> all;
+        visit(rect, [&](T* elem, const Rectangle&) { all.push_back(elem); });
+        k = std::min(k, all.size());
+        for (size_t i = 0; i < k; i++)
+            std::swap(all[i], all[std::uniform_int_distribution<size_t>(i, all.size() - 1)(rng)]);
+        return std::deque<T*>(all.begin(), all.begin() + k);
+    }
+
+    double _estimate_count(const Node<T>* subtree, const Rectangle& rect, int levels) const {
+        if (!subtree->mbr.intersects(rect))
+            return 0;
+        if (rect.contains(subtree->mbr))
+            return subtree->subtree_count;
+        if (subtree->is_leaf()) {
+            size_t n = 0;
+            for (auto entry : subtree->entries) n += entry->get_mbr().intersects(rect);
+            return n;
+        }
+        if (levels <= 0)
+            return covered_fraction(subtree->mbr, rect) * subtree->subtree_count;
+        double sum = 0;
+        for (auto entry : subtree->entries) {
+            auto* child = static_cast<const InnerNode<T>*>(entry)->node;
+            sum += _estimate_count(child, rect, levels - 1);
+        }
+        return sum;
+    }
+
+    // Fraction of the grid cells of mbr that lie inside rect (the two must intersect).
+    static double covered_fraction(const Rectangle& mbr, const Rectangle& rect) {
+        double fraction = 1;
+        for (size_t i = 0; i < mbr.lower.size(); i++) {
+            ll lo = std::max(mbr.lower[i], rect.lower[i]);
+            ll hi = std::min(mbr.higher[i], rect.higher[i]);
+            fraction *= double(hi - lo + 1) / double(mbr.higher[i] - mbr.lower[i] + 1);
+        }
+        return fraction;
+    }
+
+    template <typename Visitor>
+    void _containing(const Node<T>* subtree, const Point& p, Visitor& visit) const {
+        if (subtree->is_leaf()) {
+            for (auto entry : subtree->entries) {
+                auto* leaf = static_cast<const LeafEntry<T>*>(entry);
+                if (leaf->mbr.contains_point(p))
+                    visit(leaf->elem, leaf->mbr);
+            }
+            return;
+        }
+        for (auto entry : subtree->entries) {
+            auto* child = static_cast<const InnerNode<T>*>(entry)->node;
+            if (child->mbr.contains_point(p))
+                _containing(child, p, visit);
+        }
+    }
+
+    template <typename Visitor>
+    void _containing_batch(const Node<T>* subtree, const std::vector<size_t>& batch, size_t depth,
+                           const std::vector<Point>& points,
+                           std::vector<std::vector<size_t>>& scratch, Visitor& visit) const {
+        if (subtree->is_leaf()) {
+            for (auto i : batch) {
+                for (auto entry : subtree->entries) {
+                    auto* leaf = static_cast<const LeafEntry<T>*>(entry);
+                    if (leaf->mbr.contains_point(points[i]))
+                        visit(i, leaf->elem, leaf->mbr);
+                }
+            }
+            return;
+        }
+        // scratch[depth] is only reused once the child using it has been fully processed
+        auto& subset = scratch[depth];
+        for (auto entry : subtree->entries) {
+            auto* child = static_cast<const InnerNode<T>*>(entry)->node;
+            subset.clear();
+            for (auto i : batch) {
+                if (child->mbr.contains_point(points[i]))
+                    subset.push_back(i);
+            }
+            if (!subset.empty())
+                _containing_batch(child, subset, depth + 1, points, scratch, visit);
+        }
+    }
+
+    // Shared driver for remove_if/expire_until: `visit` decides which subtrees
+    // are worth descending into, `doomed` which leaf entries go.
+    template <typename Visit, typename Doomed>
+    size_t bulk_remove(Visit visit, Doomed doomed) {
+        if (!root)
+            return 0;
+
+        std::vector<LeafEntry<T>*> orphans;
+        size_t removed = _bulk_remove(root, visit, doomed, orphans);
+        if (removed == 0)
+            return 0;
+
+        shrink_root();
+        release_retired();
+        for (auto entry : orphans) insert_entry(entry);
+        return removed;
+    }
+
+    template <typename Visit, typename Doomed>
+    size_t _bulk_remove(Node<T>* subtree, Visit& visit, Doomed& doomed,
+                        std::vector<LeafEntry<T>*>& orphans) {
+        size_t removed = 0;
+
+        if (subtree->is_leaf()) {
+            auto& entries = subtree->get_entries();
+            for (auto it = entries.begin(); it != entries.end();) {
+                auto* entry = static_cast<LeafEntry<T>*>(*it);
+                if (doomed(entry)) {
+                    it = entries.erase(it);
+                    delete entry;
+                    removed++;
+                } else {
+                    ++it;
+                }
+            }
+        } else {
+            std::vector<Node<T>*> dissolved;
+            for (auto entry : subtree->get_entries()) {
+                auto* child = static_cast<InnerNode<T>*>(entry)->node;
+                if (!visit(child))
+                    continue;
+                size_t r = _bulk_remove(child, visit, doomed, orphans);
+                removed += r;
+                if (r && child->underflow())
+                    dissolved.push_back(child);
+            }
+
+            // Underfull children are rebuilt from scratch: their survivors are
+            // reinserted once the walk is done, which keeps every leaf at one depth.
+            for (auto child : dissolved) {
+                subtree->remove_inner_entry(child);
+                dissolve_subtree(child, orphans);
+            }
+            if (!dissolved.empty())
+                validate_and_fix_child_chain(subtree);
+        }
+
+        if (removed && !subtree->get_entries().empty()) {
+            subtree->adjust_lhv();
+            subtree->adjust_mbr();
+        }
+        return removed;
+    }
+
+    // Frees every node below (and including) `subtree`, handing the surviving
+    // leaf entries to `orphans` instead of deleting them.
+    void dissolve_subtree(Node<T>* subtree, std::vector<LeafEntry<T>*>& orphans) {
+        if (subtree->is_leaf()) {
+            for (auto entry : subtree->get_entries())
+                orphans.push_back(static_cast<LeafEntry<T>*>(entry));
+            subtree->get_entries().clear();
+        } else {
+            for (auto entry : subtree->get_entries())
+                dissolve_subtree(static_cast<InnerNode<T>*>(entry)->node, orphans);
+        }
+
+        auto prev = subtree->get_prev_siblings();
+        auto next = subtree->get_next_siblings();
+        if (prev != nullptr)
+            prev->set_next_siblings(next);
+        if (next != nullptr)
+            next->set_prev_siblings(prev);
+
+        retire_node(subtree);
+    }
+
+    // Retired nodes stay allocated until release_retired(); clearing the parent
+    // keeps get_siblings() from ever adopting one through a stale link.
+    void retire_node(Node<T>* node) {
+        all_nodes.erase(node);
+        node->parent = nullptr;
+        retired.insert(node);
+    }
+
+    // Sibling links that cross parents are not always symmetric, so splicing a
+    // node out of its chain can leave a neighbour still pointing at it. Those
+    // pointers are scrubbed from the live nodes before anything is freed; the
+    // scan is batched so its cost stays proportional to the nodes retired.
+    void release_retired() {
+        if (retired.empty() || retired.size() * 8 < all_nodes.size())
+            return;
+
+        auto is_retired = [this](Node<T>* node) {
+            return node != nullptr && retired.find(node) != retired.end();
+        };
+        for (auto node : all_nodes) {
+            if (is_retired(node->prev_sibling))
+                node->prev_sibling = nullptr;
+            if (is_retired(node->next_sibling))
+                node->next_sibling = nullptr;
+        }
+        for (auto node : retired) delete node;
+        retired.clear();
+    }
+
+    // Drops useless root levels left behind by bulk removal.
+    void shrink_root() {
+        while (!root->is_leaf() && root->get_entries().size() <= 1) {
+            if (root->get_entries().empty()) {
+                root->set_leaf(true);
+                root->reset_entries();
+                root->adjust_mbr();
+                break;
+            }
+            auto main_entry = static_cast<InnerNode<T>*>(*root->get_entries().begin());
+            Node<T>* child = main_entry->node;
+            retire_node(root);
+
+            root = child;
+            root->set_parent(nullptr);
+            root->set_prev_siblings(nullptr);
+            root->set_next_siblings(nullptr);
+        }
     }
 };
 
+// The k closest pairs between the entries of two trees; see RTree::closest_pairs().
+template <typename A, typename CurveA, typename B, typename CurveB>
+std::vector<std::tuple<A*, B*, double>> closest_pairs(const RTree<A, CurveA>& a,
+                                                      const RTree<B, CurveB>& b, size_t k) {
+    return a.closest_pairs(b, k);
+}
+
 }  // namespace hilbert
\ No newline at end of file
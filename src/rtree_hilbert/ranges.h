@@ -1,4 +1,7 @@
 #pragma once
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
 #include <stdexcept>
 #include <vector>
 
@@ -11,14 +14,19 @@ struct Range {
         if (start > end)
             throw std::invalid_argument("Range end can't be less than range start");
     }
+
+    bool operator==(const Range& other) const { return start == other.start && end == other.end; }
+    bool operator!=(const Range& other) const { return !(*this == other); }
 };
 
+// Ranges in the order they were added. A positive capacity is a hard limit and add() throws
+// once it is reached; 0 means unbounded.
 class Ranges {
     std::vector<Range> data;
     int capacity = 0;
 
    public:
-    Ranges(int capacity) : capacity(capacity) {
+    Ranges(int capacity = 0) : capacity(capacity) {
         if (capacity > 0)
             data.reserve(capacity);
     }
@@ -34,3 +42,182 @@ class Ranges {
     std::vector<Range>::const_iterator begin() const { return data.begin(); }
     std::vector<Range>::const_iterator end() const { return data.end(); }
 };
+
+// A set of keys stored as normalized ranges: sorted, and no two ranges overlap or touch, so
+// every set has exactly one representation and two lists can be combined in one linear merge.
+class RangeList {
+    std::vector<Range> data;
+
+    static uint64_t distance(ll from, ll to) { return uint64_t(to) - uint64_t(from); }
+
+    // Appends r, which must not start before the last range does.
+    void push(const Range& r) {
+        if (!data.empty() &&
+            (r.start <= data.back().end || distance(data.back().end, r.start) < 2)) {
+            data.back().end = std::max(data.back().end, r.end);
+            return;
+        }
+        data.push_back(r);
+    }
+
+    static void put_varint(std::vector<uint8_t>& out, uint64_t v) {
+        for (; v >= 0x80; v >>= 7) out.push_back(uint8_t(v | 0x80));
+        out.push_back(uint8_t(v));
+    }
+
+    static uint64_t get_varint(const std::vector<uint8_t>& in, size_t& at) {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (at == in.size())
+                throw std::runtime_error("Truncated range list");
+            uint8_t byte = in[at++];
+            v |= uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return v;
+        }
+        throw std::runtime_error("Malformed range list");
+    }
+
+   public:
+    RangeList() = default;
+
+    explicit RangeList(std::vector<Range> ranges) {
+        std::sort(ranges.begin(), ranges.end(),
+                  [](const Range& a, const Range& b) { return a.start < b.start; });
+        for (auto& r : ranges) push(r);
+    }
+
+    explicit RangeList(const Ranges& ranges)
+        : RangeList(std::vector<Range>(ranges.begin(), ranges.end())) {}
+
+    // Adds the keys of r; cheap when r starts at or after the last range.
+    void add(const Range& r) {
+        if (data.empty() || r.start >= data.back().start)
+            return push(r);
+        *this = unite(RangeList(std::vector<Range>{r}));
+    }
+
+    size_t size() const { return data.size(); }
+    bool empty() const { return data.empty(); }
+
+    // Number of keys in the set.
+    uint64_t count() const {
+        uint64_t n = 0;
+        for (auto& r : data) n += distance(r.start, r.end) + 1;
+        return n;
+    }
+
+    bool contains(ll key) const {
+        auto it = std::upper_bound(data.begin(), data.end(), key,
+                                   [](ll k, const Range& r) { return k < r.start; });
+        return it != data.begin() && std::prev(it)->end >= key;
+    }
+
+    std::vector<Range>::const_iterator begin() const { return data.begin(); }
+    std::vector<Range>::const_iterator end() const { return data.end(); }
+    const Range& operator[](size_t i) const { return data[i]; }
+
+    bool operator==(const RangeList& other) const { return data == other.data; }
+    bool operator!=(const RangeList& other) const { return !(*this == other); }
+
+    RangeList unite(const RangeList& other) const {
+        RangeList out;
+        auto a = data.begin(), b = other.data.begin();
+        while (a != data.end() || b != other.data.end()) {
+            if (b == other.data.end() || (a != data.end() && a->start <= b->start))
+                out.push(*a++);
+            else
+                out.push(*b++);
+        }
+        return out;
+    }
+
+    RangeList intersect(const RangeList& other) const {
+        RangeList out;
+        auto a = data.begin(), b = other.data.begin();
+        while (a != data.end() && b != other.data.end()) {
+            ll lo = std::max(a->start, b->start), hi = std::min(a->end, b->end);
+            if (lo <= hi)
+                out.data.emplace_back(lo, hi);
+            if (a->end < b->end)
+                ++a;
+            else
+                ++b;
+        }
+        return out;
+    }
+
+    RangeList subtract(const RangeList& other) const {
+        RangeList out;
+        auto b = other.data.begin();
+        for (auto r : data) {
+            while (b != other.data.end() && b->end < r.start) ++b;
+            auto cut = b;
+            for (; cut != other.data.end() && cut->start <= r.end; ++cut) {
+                if (cut->start > r.start)
+                    out.data.emplace_back(r.start, cut->start - 1);
+                if (cut->end >= r.end)
+                    break;
+                r.start = cut->end + 1;
+            }
+            if (cut == other.data.end() || cut->start > r.end)
+                out.data.push_back(r);
+        }
+        return out;
+    }
+
+    // Joins neighbouring ranges separated by at most max_gap missing keys, trading a few extra
+    // keys for fewer ranges.
+    RangeList coalesce(uint64_t max_gap) const {
+        RangeList out;
+        for (auto& r : data) {
+            if (!out.data.empty() && distance(out.data.back().end, r.start) - 1 <= max_gap)
+                out.data.back().end = r.end;
+            else
+                out.data.push_back(r);
+        }
+        return out;
+    }
+
+    // Compact form: LEB128 varints of the first start (zigzag), then for every range its
+    // length and the gap to the next one, so nearby ranges cost a couple of bytes each.
+    std::vector<uint8_t> encode() const {
+        std::vector<uint8_t> out;
+        put_varint(out, data.size());
+        if (data.empty())
+            return out;
+        put_varint(out, (uint64_t(data[0].start) << 1) ^ uint64_t(data[0].start >> 63));
+        for (size_t i = 0; i < data.size(); i++) {
+            put_varint(out, distance(data[i].start, data[i].end));
+            if (i + 1 < data.size())
+                put_varint(out, distance(data[i].end, data[i + 1].start) - 2);
+        }
+        return out;
+    }
+
+    static RangeList decode(const std::vector<uint8_t>& in) {
+        size_t at = 0;
+        uint64_t n = get_varint(in, at);
+        RangeList out;
+        if (n == 0)
+            return out;
+        uint64_t zigzag = get_varint(in, at);
+        ll start = ll(zigzag >> 1) ^ -ll(zigzag & 1);
+        for (uint64_t i = 0; i < n; i++) {
+            ll end = ll(uint64_t(start) + get_varint(in, at));
+            if (end < start || (!out.data.empty() && (start <= out.data.back().end ||
+                                                      distance(out.data.back().end, start) < 2)))
+                throw std::runtime_error("Malformed range list");
+            out.data.emplace_back(start, end);
+            if (i + 1 < n)
+                start = ll(uint64_t(end) + get_varint(in, at) + 2);
+        }
+        if (at != in.size())
+            throw std::runtime_error("Malformed range list");
+        return out;
+    }
+};
+
+inline RangeList operator|(const RangeList& a, const RangeList& b) { return a.unite(b); }
+inline RangeList operator&(const RangeList& a, const RangeList& b) { return a.intersect(b); }
+inline RangeList operator-(const RangeList& a, const RangeList& b) { return a.subtract(b); }
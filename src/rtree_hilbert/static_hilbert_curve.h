@@ -0,0 +1,112 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+using ll = long long;
+using Point = std::vector<ll>;
+
+// HilbertCurve with the dimension and bits fixed at compile time. The keys are the same as
+// HilbertCurve(Bits, Dim) gives, but every loop of Skilling's transform is unrolled and the
+// per-bit branches are replaced by masks, so a key costs a fixed run of shifts and xors. It can
+// stand in for HilbertCurve as the key curve of hilbert::RTree.
+template <int Dim, int Bits>
+class StaticHilbertCurve {
+    static_assert(Dim >= 1 && Bits >= 1, "You can't have negative dimensions or bits");
+    static_assert(Dim * Bits <= 63, "Keys must fit in 63 bits to stay non-negative");
+
+    using Word = unsigned long long;
+
+    template <int... I, typename F>
+    static constexpr void unroll(std::integer_sequence<int, I...>, F&& f) {
+        (f(I), ...);
+    }
+
+    template <int N, typename F>
+    static constexpr void repeat(F&& f) {
+        unroll(std::make_integer_sequence<int, N>{}, f);
+    }
+
+    // One step of the transform for axis i at bit `level`: if x[i] has that bit set, invert
+    // the low bits of x[0], otherwise exchange the low bits of x[0] and x[i].
+    static constexpr void step(std::array<Word, Dim>& x, int i, int level) {
+        Word low = (Word(1) << level) - 1;
+        Word set = Word(0) - ((x[i] >> level) & 1);
+        Word t = (x[0] ^ x[i]) & low & ~set;
+        x[0] ^= (low & set) ^ t;
+        x[i] ^= t;
+    }
+
+   public:
+    static constexpr int dims = Dim;
+    static constexpr int bits = Bits;
+    using Coords = std::array<ll, Dim>;
+
+    [[nodiscard]] static constexpr ll get_bits() { return Bits; }
+    [[nodiscard]] static constexpr ll get_dim() { return Dim; }
+    [[nodiscard]] static constexpr ll get_length() { return Dim * Bits; }
+
+    static constexpr ll index(const Coords& point) {
+        std::array<Word, Dim> x;
+        repeat<Dim>([&](int i) { x[i] = Word(point[i]); });
+
+        // inverse undo of the excess work, top level first
+        repeat<Bits - 1>([&](int k) {
+            repeat<Dim>([&](int i) { step(x, i, Bits - 1 - k); });
+        });
+
+        // Gray encode
+        repeat<Dim - 1>([&](int i) { x[i + 1] ^= x[i]; });
+        Word t = 0;
+        repeat<Bits - 1>([&](int k) {
+            int level = Bits - 1 - k;
+            t ^= ((Word(1) << level) - 1) & (Word(0) - ((x[Dim - 1] >> level) & 1));
+        });
+        repeat<Dim>([&](int i) { x[i] ^= t; });
+
+        // interleave, top bit of x[0] first
+        Word h = 0;
+        repeat<Bits>([&](int k) {
+            repeat<Dim>([&](int i) { h = (h << 1) | ((x[i] >> (Bits - 1 - k)) & 1); });
+        });
+        return ll(h);
+    }
+
+    static constexpr Coords point(ll index) {
+        std::array<Word, Dim> x{};
+        Word h = Word(index);
+        repeat<Bits>([&](int k) {
+            repeat<Dim>([&](int i) {
+                x[i] |= ((h >> (Dim * Bits - 1 - (k * Dim + i))) & 1) << (Bits - 1 - k);
+            });
+        });
+
+        // Gray decode
+        Word t = x[Dim - 1] >> 1;
+        repeat<Dim - 1>([&](int k) { x[Dim - 1 - k] ^= x[Dim - 2 - k]; });
+        x[0] ^= t;
+
+        // undo the excess work, bottom level first
+        repeat<Bits - 1>([&](int k) {
+            repeat<Dim>([&](int j) { step(x, Dim - 1 - j, k + 1); });
+        });
+
+        Coords p;
+        repeat<Dim>([&](int i) { p[i] = ll(x[i]); });
+        return p;
+    }
+
+    // Point overloads, so the curve is a drop-in for HilbertCurve
+    ll index(const Point& point) const {
+        Coords c;
+        repeat<Dim>([&](int i) { c[i] = point[i]; });
+        return index(c);
+    }
+
+    void point(ll index, Point& x) const {
+        auto c = point(index);
+        repeat<Dim>([&](int i) { x[i] = c[i]; });
+    }
+};
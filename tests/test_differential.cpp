@@ -0,0 +1,107 @@
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch_all.hpp>
+
+#include <set>
+#include <tuple>
+
+#include "benchmark/differential.h"
+#include "rtree/rtree.h"
+#include "rtree_hilbert/hilbert_rtree.h"
+
+using differential::Digest;
+using differential::Kind;
+using differential::OpStream;
+
+TEST_CASE("Differential harness tests", "[differential]") {
+    OpStream::Params params;
+    params.ops = 60000;
+    params.seed = 61;
+    params.space = 1 << 14;
+    params.max_window = 1024;
+
+    SECTION("Streams are deterministic and only touch live entries") {
+        OpStream a(params), b(params);
+        std::set<uint64_t> live;
+        differential::TraceOp x, y;
+        size_t kinds[4] = {};
+        while (a.next(x)) {
+            REQUIRE(b.next(y));
+            REQUIRE(x.kind == y.kind);
+            REQUIRE(x.id == y.id);
+            REQUIRE(x.lo == y.lo);
+            REQUIRE(x.to_lo == y.to_lo);
+            kinds[size_t(x.kind)]++;
+            if (x.kind == Kind::insert)
+                REQUIRE(live.insert(x.id).second);
+            else if (x.kind == Kind::remove)
+                REQUIRE(live.erase(x.id) == 1);
+            else if (x.kind == Kind::update)
+                REQUIRE(live.count(x.id) == 1);
+        }
+        REQUIRE_FALSE(b.next(y));
+        REQUIRE(live.size() == a.live_count());
+        for (auto count : kinds) REQUIRE(count > 0);
+    }
+
+    SECTION("Digests ignore order") {
+        Digest a, b;
+        for (uint64_t id : {3, 1, 4, 15, 9}) a.add(id);
+        for (uint64_t id : {9, 15, 4, 3, 1}) b.add(id);
+        REQUIRE(a == b);
+        b.add(2);
+        REQUIRE(a != b);
+    }
+
+    SECTION("Both trees agree with the grid reference") {
+        differential::EngineReport grid;
+        auto expected = differential::run_reference(params, grid);
+        REQUIRE(grid.ops == params.ops);
+        REQUIRE(grid.searches == expected.size());
+
+        Gutman::RTree<uint64_t> gutman(4, 8);
+        auto g = differential::run_engine("Gutman", gutman, params, expected,
+                                          [](const auto& lo, const auto& hi) {
+                                              return Gutman::Rectangle(
+                                                  std::vector<double>(lo.begin(), lo.end()),
+                                                  std::vector<double>(hi.begin(), hi.end()));
+                                          });
+        REQUIRE(g.searches == expected.size());
+        REQUIRE(g.mismatches == 0);
+
+        // ordered nodes, narrow and wide, on different axes
+        for (auto [m, M, axis] : {std::tuple{4, 8, 0}, std::tuple{32, 128, 1}}) {
+            Gutman::RTree<uint64_t> ordered(m, M);
+            ordered.order_nodes(axis);
+            auto o = differential::run_engine("Gutman ordered", ordered, params, expected,
+                                              [](const auto& lo, const auto& hi) {
+                                                  return Gutman::Rectangle(
+                                                      std::vector<double>(lo.begin(), lo.end()),
+                                                      std::vector<double>(hi.begin(), hi.end()));
+                                              });
+            REQUIRE(o.mismatches == 0);
+        }
+
+        hilbert::RTree<uint64_t> hilb(4, 8, 2, 16);
+        auto h = differential::run_engine(
+            "Hilbert", hilb, params, expected,
+            [](const auto& lo, const auto& hi) { return hilbert::Rectangle(lo, hi); });
+        REQUIRE(h.searches == expected.size());
+        REQUIRE(h.mismatches == 0);
+    }
+
+    SECTION("A diverging engine is caught") {
+        differential::EngineReport grid;
+        auto expected = differential::run_reference(params, grid);
+        // an engine that silently drops removals, simulated by a stream without them
+        params.remove_pct = 0;
+        Gutman::RTree<uint64_t> tree(4, 8);
+        auto r = differential::run_engine("Broken", tree, params, expected,
+                                          [](const auto& lo, const auto& hi) {
+                                              return Gutman::Rectangle(
+                                                  std::vector<double>(lo.begin(), lo.end()),
+                                                  std::vector<double>(hi.begin(), hi.end()));
+                                          });
+        REQUIRE(r.mismatches > 0);
+        REQUIRE(r.first_mismatch < params.ops);
+    }
+}
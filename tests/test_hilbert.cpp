@@ -1,9 +1,15 @@
 #define CATCH_CONFIG_MAIN
 #include <catch2/catch_all.hpp>
 
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <set>
+
 #include "rtree_hilbert/box.h"
 #include "rtree_hilbert/hilbert_curve.h"
 #include "rtree_hilbert/ranges.h"
+#include "rtree_hilbert/static_hilbert_curve.h"
 
 using Point = std::vector<ll>;
 
@@ -691,3 +697,332 @@ TEST_CASE("HilbertCurve: error handling", "[hilbert][errors]")
         REQUIRE_THROWS_AS(H.query(a, b, -1), std::domain_error);
     }
 }
+
+TEST_CASE("HilbertCurve: per-axis bits", "[hilbert][compact]")
+{
+    SECTION("Equal widths are the plain curve")
+    {
+        HilbertCurve plain(4, 3);
+        HilbertCurve axes(std::vector<int>{4, 4, 4});
+        REQUIRE_FALSE(axes.is_compact());
+        for (ll i = 0; i <= plain.max_index(); i++)
+            REQUIRE(axes.index(plain.point(i)) == i);
+    }
+
+    SECTION("Compact index is a bijection onto sum(bits) bits")
+    {
+        for (auto bits : std::vector<std::vector<int>>{{5, 2}, {2, 5}, {4, 1, 3}, {6, 3, 1}})
+        {
+            HilbertCurve H(bits);
+            REQUIRE(H.is_compact());
+            int len = 0;
+            for (auto b : bits)
+                len += b;
+            REQUIRE(H.get_length() == len);
+            REQUIRE(H.max_index() == (1ll << len) - 1);
+
+            Point x(bits.size());
+            for (ll i = 0; i <= H.max_index(); i++)
+            {
+                H.point(i, x);
+                for (size_t d = 0; d < bits.size(); d++)
+                {
+                    REQUIRE(x[d] >= 0);
+                    REQUIRE(x[d] < (1ll << bits[d]));
+                }
+                REQUIRE(H.index(x) == i);
+            }
+        }
+    }
+
+    SECTION("Compact keys keep locality")
+    {
+        // consecutive keys are mostly neighbouring cells; the compact index may jump where the
+        // full curve leaves the narrower axes' range, but only rarely
+        HilbertCurve H(std::vector<int>{6, 3});
+        int adjacent = 0;
+        Point prev = H.point(0);
+        for (ll i = 1; i <= H.max_index(); i++)
+        {
+            Point p = H.point(i);
+            adjacent += std::abs(p[0] - prev[0]) + std::abs(p[1] - prev[1]) == 1;
+            prev = p;
+        }
+        REQUIRE(adjacent >= 0.9 * H.max_index());
+    }
+
+    SECTION("Keys fit in 63 bits")
+    {
+        HilbertCurve wide(std::vector<int>{40, 23});
+        Point p{(1ll << 40) - 1, (1ll << 23) - 1};
+        REQUIRE(wide.point(wide.index(p)) == p);
+        REQUIRE_THROWS_AS(HilbertCurve(std::vector<int>{40, 24}), std::domain_error);
+        REQUIRE_THROWS_AS(HilbertCurve(std::vector<int>{4, 0}), std::domain_error);
+        REQUIRE_THROWS_AS(HilbertCurve(std::vector<int>{}), std::domain_error);
+    }
+}
+
+TEST_CASE("StaticHilbertCurve: same keys as HilbertCurve", "[hilbert][static]")
+{
+    auto check = [](auto curve, int samples)
+    {
+        constexpr int dims = decltype(curve)::dims, bits = decltype(curve)::bits;
+        HilbertCurve H(bits, dims);
+        std::mt19937_64 rng(dims * 100 + bits);
+        unsigned long long mask = (1ull << bits) - 1;
+        Point p(dims), q(dims);
+        for (int s = 0; s < samples; s++)
+        {
+            for (auto& c : p)
+                c = ll(rng() & mask);
+            ll index = curve.index(p);
+            REQUIRE(index == H.index(p));
+            curve.point(index, q);
+            REQUIRE(q == p);
+        }
+    };
+    check(StaticHilbertCurve<1, 16>{}, 1000);
+    check(StaticHilbertCurve<2, 1>{}, 100);
+    check(StaticHilbertCurve<2, 8>{}, 5000);
+    check(StaticHilbertCurve<2, 31>{}, 20000);
+    check(StaticHilbertCurve<3, 21>{}, 20000);
+    check(StaticHilbertCurve<5, 12>{}, 5000);
+
+    SECTION("Keys keep their order at the widest shapes")
+    {
+        auto check_order = [](auto curve)
+        {
+            constexpr int dims = decltype(curve)::dims, bits = decltype(curve)::bits;
+            HilbertCurve H(bits, dims);
+            std::mt19937_64 rng(dims * 1000 + bits);
+            ll top = (1ll << bits) - 1;
+            std::vector<Point> points{Point(dims, 0), Point(dims, top)};
+            for (int s = 0; s < 2000; s++)
+            {
+                Point p(dims);
+                for (auto& c : p)
+                    c = rng() % 3 ? ll(rng() & top) : top - ll(rng() % 4);
+                points.push_back(p);
+            }
+            std::vector<std::pair<ll, ll>> keys;
+            for (auto& p : points)
+                keys.push_back({curve.index(p), H.index(p)});
+            std::sort(keys.begin(), keys.end());
+            REQUIRE(keys.front().first >= 0);
+            for (size_t i = 1; i < keys.size(); i++)
+                REQUIRE(keys[i - 1].second <= keys[i].second);
+        };
+        check_order(StaticHilbertCurve<2, 31>{});
+        check_order(StaticHilbertCurve<3, 21>{});
+        check_order(StaticHilbertCurve<7, 9>{});
+        check_order(StaticHilbertCurve<63, 1>{});
+    }
+
+    SECTION("Usable in constant expressions")
+    {
+        constexpr auto p = StaticHilbertCurve<2, 3>::point(42);
+        static_assert(StaticHilbertCurve<2, 3>::index(p) == 42);
+        REQUIRE(HilbertCurve(3, 2).index(Point{p[0], p[1]}) == 42);
+    }
+}
+
+TEST_CASE("Box: perimeter iterator", "[box][perimeter]")
+{
+    SECTION("Exactly the boundary cells, each once")
+    {
+        std::mt19937 rng(73);
+        for (int round = 0; round < 200; round++)
+        {
+            int dim = 1 + round % 4;
+            Point lo(dim), hi(dim);
+            for (int i = 0; i < dim; i++)
+            {
+                lo[i] = rng() % 10;
+                hi[i] = lo[i] + rng() % 5;  // includes flat boxes
+            }
+            Box B(lo, hi);
+
+            std::set<Point> expected;
+            Point p(lo);
+            while (true)
+            {
+                bool boundary = false;
+                for (int i = 0; i < dim; i++)
+                    boundary |= p[i] == lo[i] || p[i] == hi[i];
+                if (boundary)
+                    expected.insert(p);
+                int i = dim - 1;
+                for (; i >= 0 && p[i] == hi[i]; i--)
+                    p[i] = lo[i];
+                if (i < 0)
+                    break;
+                p[i]++;
+            }
+
+            std::vector<Point> cells(B.perimeter().begin(), B.perimeter().end());
+            REQUIRE(cells.size() == expected.size());
+            REQUIRE(std::set<Point>(cells.begin(), cells.end()) == expected);
+
+            size_t visited = 0;
+            B.visit_perimiter([&](const Point& cell) { visited += expected.count(cell); });
+            REQUIRE(visited == expected.size());
+        }
+    }
+
+    SECTION("Only touches the surface")
+    {
+        // a 1000 x 1000 box has a million cells but only 3996 on its boundary
+        Box B({0, 0}, {999, 999});
+        size_t count = 0;
+        for (const auto& cell : B.perimeter())
+            count += cell.size() == 2;
+        REQUIRE(count == 3996);
+    }
+
+    SECTION("Single cell and inverted boxes")
+    {
+        Box cell({3, 4}, {3, 4});
+        std::vector<Point> one(cell.perimeter().begin(), cell.perimeter().end());
+        REQUIRE(one == std::vector<Point>{{3, 4}});
+
+        Box inverted({5, 0}, {4, 3});
+        REQUIRE(inverted.perimeter().begin() == inverted.perimeter().end());
+    }
+}
+
+TEST_CASE("RangeList: set algebra", "[ranges]")
+{
+    auto keys = [](const RangeList& list)
+    {
+        std::set<ll> out;
+        for (const auto& r : list)
+            for (ll k = r.start; k <= r.end; k++)
+                out.insert(k);
+        return out;
+    };
+    auto random_list = [](std::mt19937& rng)
+    {
+        std::vector<Range> ranges;
+        int n = rng() % 8;
+        for (int i = 0; i < n; i++)
+        {
+            ll start = ll(rng() % 64) - 16;
+            ranges.emplace_back(start, start + rng() % 6);
+        }
+        return RangeList(ranges);
+    };
+
+    SECTION("Normalized on construction")
+    {
+        RangeList list({{10, 12}, {0, 3}, {4, 5}, {11, 20}, {30, 30}});
+        REQUIRE(list.size() == 3);
+        REQUIRE(list[0] == Range(0, 5));
+        REQUIRE(list[1] == Range(10, 20));
+        REQUIRE(list[2] == Range(30, 30));
+        REQUIRE(list.count() == 18);
+        REQUIRE(list.contains(0));
+        REQUIRE(list.contains(20));
+        REQUIRE_FALSE(list.contains(7));
+        REQUIRE_FALSE(list.contains(-1));
+
+        list.add({30, 30});
+        list.add({6, 9});
+        REQUIRE(list.size() == 2);
+        REQUIRE(list[0] == Range(0, 20));
+    }
+
+    SECTION("Union, intersection and difference match std::set")
+    {
+        std::mt19937 rng(7);
+        for (int t = 0; t < 500; t++)
+        {
+            RangeList a = random_list(rng), b = random_list(rng);
+            std::set<ll> ka = keys(a), kb = keys(b), expected;
+
+            std::set_union(ka.begin(), ka.end(), kb.begin(), kb.end(),
+                           std::inserter(expected, expected.end()));
+            REQUIRE(keys(a | b) == expected);
+
+            expected.clear();
+            std::set_intersection(ka.begin(), ka.end(), kb.begin(), kb.end(),
+                                  std::inserter(expected, expected.end()));
+            REQUIRE(keys(a & b) == expected);
+
+            expected.clear();
+            std::set_difference(ka.begin(), ka.end(), kb.begin(), kb.end(),
+                                std::inserter(expected, expected.end()));
+            REQUIRE(keys(a - b) == expected);
+
+            // results are normalized, so equal sets compare equal
+            REQUIRE(((a - b) | (a & b)) == a);
+        }
+    }
+
+    SECTION("Coalescing joins small gaps only")
+    {
+        RangeList list({{0, 1}, {4, 5}, {9, 9}, {20, 22}});
+        REQUIRE(list.coalesce(0) == list);
+        REQUIRE(list.coalesce(2) == RangeList({{0, 5}, {9, 9}, {20, 22}}));
+        REQUIRE(list.coalesce(3) == RangeList({{0, 9}, {20, 22}}));
+        REQUIRE(list.coalesce(10).size() == 1);
+    }
+
+    SECTION("Compact encoding round trips")
+    {
+        std::mt19937 rng(11);
+        for (int t = 0; t < 200; t++)
+        {
+            RangeList list = random_list(rng);
+            REQUIRE(RangeList::decode(list.encode()) == list);
+        }
+        RangeList wide({{-(1ll << 62), -(1ll << 40)}, {5, 6}, {(1ll << 62), (1ll << 62) + 1}});
+        REQUIRE(RangeList::decode(wide.encode()) == wide);
+
+        // a thousand nearby ranges take two bytes each
+        std::vector<Range> near;
+        for (ll i = 0; i < 1000; i++)
+            near.emplace_back(1000000 + 10 * i, 1000000 + 10 * i + 3);
+        REQUIRE(RangeList(near).encode().size() < 2100);
+
+        auto bytes = wide.encode();
+        bytes.pop_back();
+        REQUIRE_THROWS_AS(RangeList::decode(bytes), std::runtime_error);
+    }
+
+    SECTION("Unbounded Ranges grow, bounded ones still throw")
+    {
+        Ranges unbounded;
+        for (int i = 0; i < 5000; i++)
+            unbounded.add({i, i});
+        REQUIRE(unbounded.size() == 5000);
+
+        Ranges bounded(1);
+        bounded.add({0, 0});
+        REQUIRE_THROWS_AS(bounded.add({1, 1}), std::runtime_error);
+    }
+
+    SECTION("Multi-window query covers exactly the windows")
+    {
+        HilbertCurve H(4, 2);
+        std::mt19937 rng(3);
+        for (int t = 0; t < 50; t++)
+        {
+            std::vector<std::pair<Point, Point>> windows;
+            for (int w = 0; w < 3; w++)
+            {
+                Point lo{ll(rng() % 12), ll(rng() % 12)};
+                windows.push_back({lo, {lo[0] + ll(rng() % 4), lo[1] + ll(rng() % 4)}});
+            }
+            RangeList list = H.query(windows);
+            for (ll x = 0; x < 16; x++)
+                for (ll y = 0; y < 16; y++)
+                {
+                    bool inside = false;
+                    for (const auto& [lo, hi] : windows)
+                        inside |= lo[0] <= x && x <= hi[0] && lo[1] <= y && y <= hi[1];
+                    REQUIRE(list.contains(H.index({x, y})) == inside);
+                }
+            REQUIRE(H.query(windows, 1000).size() == 1);
+        }
+    }
+}
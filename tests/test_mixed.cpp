@@ -0,0 +1,63 @@
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch_all.hpp>
+
+#include <memory>
+
+#include "benchmark/mixed.h"
+#include "rtree/rtree.h"
+#include "rtree_hilbert/hilbert_rtree.h"
+
+TEST_CASE("Mixed workload tests", "[mixed]") {
+    using Gutman::Operation;
+    mixed::Config config;
+    config.duration = std::chrono::milliseconds(150);
+    config.initial_entries = 2000;
+    config.space = 10000;
+    config.window = 200;
+
+    auto gutman = [&](const mixed::Config& c) {
+        return mixed::run([] { return std::make_unique<Gutman::RTree<uint64_t>>(4, 8); }, c,
+                          [](const auto& lo, const auto& hi) {
+                              return Gutman::Rectangle(std::vector<double>(lo.begin(), lo.end()),
+                                                       std::vector<double>(hi.begin(), hi.end()));
+                          });
+    };
+    auto hilb = [&](const mixed::Config& c) {
+        return mixed::run([] { return std::make_unique<hilbert::RTree<uint64_t>>(4, 8, 2, 16); },
+                          c, [](const auto& lo, const auto& hi) {
+                              return hilbert::Rectangle(lo, hi);
+                          });
+    };
+
+    SECTION("Every operation is accounted for") {
+        config.mixed = 3;
+        config.read_fraction = 0.5;
+        for (auto& result : {gutman(config), hilb(config)}) {
+            auto searches = result.of(Operation::search).count();
+            auto writes =
+                result.of(Operation::insert).count() + result.of(Operation::remove).count();
+            REQUIRE(result.ops > 0);
+            REQUIRE(searches + writes == result.ops);
+            REQUIRE(searches > 0);
+            REQUIRE(writes > 0);
+            REQUIRE(result.of(Operation::update).count() == 0);
+            REQUIRE(result.throughput() > 0);
+            REQUIRE(result.of(Operation::search).percentile(0.5) <=
+                    result.of(Operation::search).percentile(0.999));
+        }
+    }
+
+    SECTION("Dedicated readers and writers") {
+        config.mixed = 0;
+        config.readers = 2;
+        config.writers = 0;
+        auto reads_only = gutman(config);
+        REQUIRE(reads_only.of(Operation::search).count() == reads_only.ops);
+
+        config.readers = 0;
+        config.writers = 2;
+        auto writes_only = hilb(config);
+        REQUIRE(writes_only.of(Operation::search).count() == 0);
+        REQUIRE(writes_only.of(Operation::insert).count() > 0);
+    }
+}
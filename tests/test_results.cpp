@@ -0,0 +1,94 @@
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch_all.hpp>
+
+#include <cmath>
+#include <sstream>
+
+#include "benchmark/results.h"
+
+TEST_CASE("Benchmark results tests", "[results]") {
+    SECTION("Metrics summarise their samples") {
+        bench::Metric m{"m", "s", true, {4, 1, 3, 2}};
+        REQUIRE(m.mean() == 2.5);
+        REQUIRE(m.median() == 2.5);
+        REQUIRE(m.min() == 1);
+        REQUIRE(m.max() == 4);
+        REQUIRE(std::fabs(m.stddev() - std::sqrt(5.0 / 3)) < 1e-12);
+        REQUIRE(bench::Metric{"x", "s", true, {7}}.stddev() == 0);
+    }
+
+    SECTION("JSON round trip keeps environment, config and samples") {
+        bench::Results results;
+        results.config["dataset"] = "a \"quoted\"\\path\n";
+        results.add("insert", "s", 0.125);
+        results.add("throughput", "ops/s", 1e6, false);
+        results.add("insert", "s", 1.0 / 3);
+        REQUIRE(results.metrics().size() == 2);
+        REQUIRE(results.environment.count("cores"));
+
+        std::stringstream json;
+        results.write_json(json);
+        auto back = bench::Results::read_json(json);
+        REQUIRE(back.environment == results.environment);
+        REQUIRE(back.config == results.config);
+        REQUIRE(back.metrics().size() == 2);
+        auto insert = back.find("insert");
+        REQUIRE(insert);
+        REQUIRE(insert->unit == "s");
+        REQUIRE(insert->lower_is_better);
+        REQUIRE(insert->samples == std::vector<double>{0.125, 1.0 / 3});
+        REQUIRE_FALSE(back.find("throughput")->lower_is_better);
+    }
+
+    SECTION("Malformed files are rejected") {
+        std::istringstream missing("{\"environment\": {}}");
+        REQUIRE_THROWS_AS(bench::Results::read_json(missing), std::runtime_error);
+        std::istringstream truncated("{\"metrics\": [");
+        REQUIRE_THROWS_AS(bench::Results::read_json(truncated), std::runtime_error);
+    }
+
+    SECTION("Welch p-values match the t distribution") {
+        REQUIRE(std::fabs(bench::incomplete_beta(2, 2, 0.5) - 0.5) < 1e-12);
+        // t = -5 with 8 degrees of freedom
+        bench::Metric a{"a", "s", true, {1, 2, 3, 4, 5}};
+        bench::Metric b{"b", "s", true, {6, 7, 8, 9, 10}};
+        REQUIRE(std::fabs(bench::welch_p_value(a, b) - 0.0010528) < 1e-6);
+        REQUIRE(std::fabs(bench::welch_p_value(a, a) - 1) < 1e-12);
+        REQUIRE(std::isnan(bench::welch_p_value(a, bench::Metric{"c", "s", true, {1}})));
+    }
+
+    SECTION("Only significant changes in the worse direction are regressions") {
+        bench::Results base, current;
+        for (double noise : {-0.02, -0.01, 0.0, 0.01, 0.02}) {
+            base.add("slower", "s", 1 + noise);
+            current.add("slower", "s", 1.5 + noise);
+            base.add("faster", "s", 1 + noise);
+            current.add("faster", "s", 0.5 + noise);
+            base.add("noisy", "s", 1 + 20 * noise);
+            current.add("noisy", "s", 1.05 - 20 * noise);
+            base.add("throughput", "ops/s", 100 + noise, false);
+            current.add("throughput", "ops/s", 50 + noise, false);
+        }
+        current.add("new only", "s", 1);
+
+        auto comparisons = bench::compare(base, current);
+        REQUIRE(comparisons.size() == 4);
+        for (auto& c : comparisons) {
+            if (c.name == "slower" || c.name == "throughput") {
+                REQUIRE(c.regression);
+            } else if (c.name == "faster") {
+                REQUIRE(c.improvement);
+                REQUIRE_FALSE(c.regression);
+            } else {
+                REQUIRE_FALSE(c.significant);
+            }
+        }
+        // a significant but tiny change is not flagged
+        bench::Results a, b;
+        for (double noise : {0.0, 1e-6, 2e-6}) {
+            a.add("m", "s", 1 + noise);
+            b.add("m", "s", 1.001 + noise);
+        }
+        REQUIRE_FALSE(bench::compare(a, b)[0].regression);
+    }
+}
@@ -1,6 +1,16 @@
 #define CATCH_CONFIG_MAIN
 #include <catch2/catch_all.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#include "rtree/continuous_query.h"
 #include "rtree/rtree.h"  // Adjust include path for your Gutman::RTree
 
 // Helper alias (assuming you have makeRect defined somewhere)
@@ -462,3 +472,941 @@ TEST_CASE("RTree stress and condense tests", "[stress]") {
         REQUIRE(results.size() == N);
     }
 }
+
+// ------------------- Bulk Removal Tests -------------------
+TEST_CASE("RTree bulk removal tests", "[remove_if]") {
+    auto always = [](int*, const Rectangle&) { return true; };
+
+    SECTION("Remove everything in a window") {
+        Gutman::RTree<int> tree(2, 4);
+        std::vector<int> values(100);
+        for (int i = 0; i < 100; i++) {
+            values[i] = i;
+            double x = (i % 10) * 2.0;
+            double y = (i / 10) * 2.0;
+            tree.insert(makeRect({x, y}, {x + 1, y + 1}), &values[i]);
+        }
+
+        size_t removed = tree.remove_if(makeRect({-1, -1}, {9.5, 9.5}), always);
+        REQUIRE(removed == 25);
+        REQUIRE(tree.search(makeRect({-1, -1}, {30, 30})).size() == 75);
+        REQUIRE(tree.search(makeRect({-1, -1}, {9.5, 9.5})).empty());
+    }
+
+    SECTION("Remove by predicate") {
+        Gutman::RTree<int> tree(2, 4);
+        std::vector<int> values(200);
+        for (int i = 0; i < 200; i++) {
+            values[i] = i;
+            double x = (i % 20) * 1.5;
+            double y = (i / 20) * 1.5;
+            tree.insert(makeRect({x, y}, {x + 1, y + 1}), &values[i]);
+        }
+
+        size_t removed = tree.remove_if(makeRect({-1, -1}, {100, 100}),
+                                        [](int* v, const Rectangle&) { return *v % 3 == 0; });
+        REQUIRE(removed == 67);
+
+        auto results = tree.search(makeRect({-1, -1}, {100, 100}));
+        REQUIRE(results.size() == 133);
+        for (auto r : results) REQUIRE(*r % 3 != 0);
+    }
+
+    SECTION("Remove all entries and reuse the tree") {
+        Gutman::RTree<int> tree(4, 8);
+        std::vector<int> values(500);
+        std::vector<Rectangle> rects;
+        for (int i = 0; i < 500; i++) {
+            values[i] = i;
+            rects.push_back(makeRect({(double)i, (double)i}, {(double)i + 1, (double)i + 1}));
+            tree.insert(rects[i], &values[i]);
+        }
+
+        REQUIRE(tree.remove_if(makeRect({-1, -1}, {1000, 1000}), always) == 500);
+        REQUIRE(tree.search(makeRect({-1, -1}, {1000, 1000})).empty());
+        REQUIRE(tree.remove_if(makeRect({-1, -1}, {1000, 1000}), always) == 0);
+
+        for (int i = 0; i < 500; i++) tree.insert(rects[i], &values[i]);
+        REQUIRE(tree.search(makeRect({-1, -1}, {1000, 1000})).size() == 500);
+    }
+
+    SECTION("Repeated window expiry keeps the tree consistent") {
+        Gutman::RTree<int> tree(8, 16);
+        const int N = 20000;
+        std::vector<int> values(N);
+        for (int i = 0; i < N; i++) {
+            values[i] = i;
+            double x = (i % 200) * 2.0;
+            double y = (i / 200) * 2.0;
+            tree.insert(makeRect({x, y}, {x + 1, y + 1}), &values[i]);
+        }
+
+        size_t left = N;
+        for (int band = 0; band < 10; band++) {
+            double y0 = band * 20.0;
+            left -= tree.remove_if(makeRect({-1, y0 - 0.5}, {1000, y0 + 9.5}), always);
+            REQUIRE(tree.search(makeRect({-1, -1}, {1000, 1000})).size() == left);
+        }
+        REQUIRE(left == N / 2);
+    }
+}
+
+// ------------------- Expiry Tests -------------------
+TEST_CASE("RTree expiry tests", "[expiry]") {
+    SECTION("Entries without expiry never expire") {
+        Gutman::RTree<int> tree(2, 4);
+        std::vector<int> values(20);
+        for (int i = 0; i < 20; i++) {
+            values[i] = i;
+            tree.insert(makeRect({(double)i, 0}, {(double)i + 1, 1}), &values[i]);
+        }
+        REQUIRE(tree.expire_until(Gutman::never_expires - 1) == 0);
+        REQUIRE(tree.search(makeRect({-1, -1}, {50, 50})).size() == 20);
+    }
+
+    SECTION("Expire in time order") {
+        Gutman::RTree<int> tree(4, 8);
+        const int N = 2000;
+        std::vector<int> values(N);
+        for (int i = 0; i < N; i++) {
+            values[i] = i;
+            double x = (i % 50) * 2.0;
+            double y = (i / 50) * 2.0;
+            tree.insert(makeRect({x, y}, {x + 1, y + 1}), &values[i], i % 100);
+        }
+
+        auto everything = makeRect({-1, -1}, {1000, 1000});
+        REQUIRE(tree.search(everything, 49).size() == N / 2);
+        REQUIRE(tree.search(everything).size() == N);
+
+        REQUIRE(tree.expire_until(49) == N / 2);
+        auto results = tree.search(everything);
+        REQUIRE(results.size() == N / 2);
+        for (auto r : results) REQUIRE(*r % 100 >= 50);
+
+        REQUIRE(tree.expire_until(49) == 0);
+        REQUIRE(tree.expire_until(99) == N / 2);
+        REQUIRE(tree.search(everything).empty());
+    }
+
+    SECTION("Expiry survives removal and reinsertion") {
+        Gutman::RTree<int> tree(2, 4);
+        std::vector<int> values(200);
+        std::vector<Rectangle> rects;
+        for (int i = 0; i < 200; i++) {
+            values[i] = i;
+            rects.push_back(makeRect({(double)i, (double)i}, {(double)i + 0.5, (double)i + 0.5}));
+            tree.insert(rects[i], &values[i], i < 100 ? 10 : Gutman::never_expires);
+        }
+        // condense reinsertion must carry each entry's expiry along
+        for (int i = 0; i < 200; i += 3) tree.remove(rects[i]);
+
+        REQUIRE(tree.expire_until(10) == 66);
+        auto results = tree.search(makeRect({-1, -1}, {500, 500}));
+        REQUIRE(results.size() == 67);
+        for (auto r : results) REQUIRE(*r >= 100);
+    }
+
+    SECTION("Expiry survives an update") {
+        Gutman::RTree<int> tree(2, 4);
+        std::vector<int> values(50);
+        for (int i = 0; i < 50; i++) {
+            values[i] = i;
+            tree.insert(makeRect({(double)i, 0}, {(double)i + 0.5, 1}), &values[i],
+                        i % 2 ? 10 : 20);
+        }
+        for (int i = 0; i < 50; i += 5) {
+            auto moved = makeRect({(double)i, 10}, {(double)i + 0.5, 11});
+            tree.update(makeRect({(double)i, 0}, {(double)i + 0.5, 1}), moved, &values[i]);
+        }
+
+        REQUIRE(tree.expire_until(10) == 25);
+        auto results = tree.search(makeRect({-1, -1}, {100, 100}));
+        REQUIRE(results.size() == 25);
+        for (auto r : results) REQUIRE(*r % 2 == 0);
+        REQUIRE(tree.expire_until(20) == 25);
+    }
+}
+
+TEST_CASE("RTree continuous query tests", "[continuous]") {
+    Gutman::RTree<int> tree(4, 8);
+    const int N = 3000;
+    std::vector<int> values(N);
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> coord(0, 990), extent(0, 9);
+    for (int i = 0; i < N; i++) {
+        values[i] = i;
+        double x = coord(rng), y = coord(rng);
+        tree.insert(makeRect({x, y}, {x + extent(rng), y + extent(rng)}), &values[i]);
+    }
+
+    auto in_window = [&](const Rectangle& window) {
+        auto found = tree.search(window);
+        return std::set<int*>(found.begin(), found.end());
+    };
+
+    SECTION("First move reports the whole window") {
+        Gutman::ContinuousQuery<int> query(tree);
+        auto window = makeRect({100, 100}, {300, 300});
+        auto delta = query.move_to(window);
+        REQUIRE(delta.removed.empty());
+        REQUIRE(std::set<int*>(delta.added.begin(), delta.added.end()) == in_window(window));
+        REQUIRE(delta.added.size() == in_window(window).size());
+    }
+
+    SECTION("Panning reports exactly the entries that entered and left") {
+        Gutman::ContinuousQuery<int> query(tree);
+        std::set<int*> visible;
+        std::uniform_int_distribution<int> step(-40, 40), jump(0, 800);
+        double x = 200, y = 200;
+        for (int move = 0; move < 200; move++) {
+            if (move % 50 == 49) {
+                // occasionally jump somewhere with no overlap at all
+                x = jump(rng);
+                y = jump(rng);
+            } else {
+                x = std::max<double>(0, x + step(rng));
+                y = std::max<double>(0, y + step(rng));
+            }
+            auto window = makeRect({x, y}, {x + 150 + move % 7, y + 120});
+            auto delta = query.move_to(window);
+
+            std::set<int*> added(delta.added.begin(), delta.added.end());
+            std::set<int*> removed(delta.removed.begin(), delta.removed.end());
+            REQUIRE(added.size() == delta.added.size());
+            REQUIRE(removed.size() == delta.removed.size());
+            for (auto r : removed) REQUIRE(visible.erase(r) == 1);
+            for (auto a : added) REQUIRE(visible.insert(a).second);
+            REQUIRE(visible == in_window(window));
+        }
+    }
+
+    SECTION("Reset starts over") {
+        Gutman::ContinuousQuery<int> query(tree);
+        auto window = makeRect({0, 0}, {500, 500});
+        query.move_to(window);
+        REQUIRE(query.move_to(window).added.empty());
+        query.reset();
+        REQUIRE(query.move_to(window).added.size() == in_window(window).size());
+    }
+}
+
+TEST_CASE("RTree stabbing query tests", "[containing]") {
+    Gutman::RTree<int> tree(4, 8);
+    const int N = 2000;
+    std::vector<int> values(N);
+    std::vector<Rectangle> fences;
+    std::mt19937 rng(11);
+    std::uniform_int_distribution<int> coord(0, 1000), extent(0, 120);
+    for (int i = 0; i < N; i++) {
+        values[i] = i;
+        double x = coord(rng), y = coord(rng);
+        fences.push_back(makeRect({x, y}, {x + extent(rng), y + extent(rng)}));
+        tree.insert(fences.back(), &values[i]);
+    }
+
+    auto brute_force = [&](const std::vector<double>& p) {
+        std::set<int*> expected;
+        for (int i = 0; i < N; i++) {
+            if (fences[i].contains_point(p))
+                expected.insert(&values[i]);
+        }
+        return expected;
+    };
+
+    std::vector<std::vector<double>> points;
+    for (int i = 0; i < 500; i++) points.push_back({double(coord(rng)), double(coord(rng))});
+    // corners of a fence are inside it
+    points.push_back(fences[0].min);
+    points.push_back(fences[0].max);
+
+    SECTION("Single point matches brute force") {
+        for (auto& p : points) {
+            auto found = tree.containing(p);
+            std::set<int*> got(found.begin(), found.end());
+            REQUIRE(got.size() == found.size());
+            REQUIRE(got == brute_force(p));
+        }
+        REQUIRE(tree.containing({5000, 5000}).empty());
+    }
+
+    SECTION("Batch matches per-point queries") {
+        std::vector<std::set<int*>> got(points.size());
+        size_t matches = 0;
+        tree.containing_batch(points, [&](size_t i, int* elem, const Rectangle& rect) {
+            REQUIRE(rect.contains_point(points[i]));
+            REQUIRE(got[i].insert(elem).second);
+            matches++;
+        });
+        REQUIRE(matches > 0);
+        for (size_t i = 0; i < points.size(); i++) REQUIRE(got[i] == brute_force(points[i]));
+    }
+
+    SECTION("Empty batch and empty tree") {
+        int calls = 0;
+        auto count = [&](size_t, int*, const Rectangle&) { calls++; };
+        tree.containing_batch(std::vector<std::vector<double>>{}, count);
+        Gutman::RTree<int> empty(4, 8);
+        empty.containing_batch(points, count);
+        REQUIRE(calls == 0);
+        REQUIRE(empty.containing(points[0]).empty());
+    }
+}
+
+TEST_CASE("RTree selectivity estimate tests", "[estimate]") {
+    Gutman::RTree<int> tree(4, 8);
+    REQUIRE(tree.estimate_count(makeRect({0, 0}, {10, 10})) == 0);
+
+    const int N = 5000;
+    std::vector<int> values(N);
+    std::vector<Rectangle> rects;
+    std::mt19937 rng(5);
+    std::uniform_int_distribution<int> coord(0, 2000);
+    for (int i = 0; i < N; i++) {
+        values[i] = i;
+        double x = coord(rng), y = coord(rng);
+        rects.push_back(makeRect({x, y}, {x + 2, y + 2}));
+        tree.insert(rects.back(), &values[i]);
+    }
+
+    SECTION("Windows covering everything or nothing are exact") {
+        REQUIRE(tree.estimate_count(makeRect({-10, -10}, {3000, 3000})) == N);
+        REQUIRE(tree.estimate_count(makeRect({5000, 5000}, {6000, 6000})) == 0);
+    }
+
+    SECTION("Descending to the leaves gives the exact count") {
+        auto window = makeRect({300, 400}, {900, 1250});
+        REQUIRE(tree.estimate_count(window, 100) == tree.search(window).size());
+    }
+
+    SECTION("Shallow estimates are close on uniform data") {
+        auto window = makeRect({200, 200}, {1400, 1000});
+        double exact = tree.search(window).size();
+        for (int levels = 0; levels <= 2; levels++) {
+            double estimate = tree.estimate_count(window, levels);
+            REQUIRE(estimate > exact * 0.7);
+            REQUIRE(estimate < exact * 1.3);
+        }
+    }
+
+    SECTION("Counts follow removals") {
+        for (int i = 0; i < N; i += 2) tree.remove(rects[i]);
+        auto everything = makeRect({-10, -10}, {3000, 3000});
+        REQUIRE(tree.estimate_count(everything) == N / 2);
+        auto window = makeRect({0, 0}, {1000, 2000});
+        REQUIRE(tree.estimate_count(window, 100) == tree.search(window).size());
+    }
+}
+
+TEST_CASE("RTree sampling tests", "[sample]") {
+    Gutman::RTree<int> tree(4, 8);
+    std::mt19937 rng(17);
+    REQUIRE(tree.sample(makeRect({0, 0}, {10, 10}), 5, rng).empty());
+
+    // 100 x 100 grid of unit cells
+    std::vector<int> values(10000);
+    for (int i = 0; i < 10000; i++) {
+        values[i] = i;
+        double x = (i % 100) * 3, y = (i / 100) * 3;
+        tree.insert(makeRect({x, y}, {x + 1, y + 1}), &values[i]);
+    }
+    auto in_window = [](int v, int x0, int y0, int x1, int y1) {
+        int x = (v % 100) * 3, y = (v / 100) * 3;
+        return x + 1 >= x0 && x <= x1 && y + 1 >= y0 && y <= y1;
+    };
+
+    SECTION("Samples are distinct entries from the window") {
+        auto window = makeRect({30, 60}, {200, 250});
+        auto sample = tree.sample(window, 300, rng);
+        REQUIRE(sample.size() == 300);
+        std::set<int*> distinct(sample.begin(), sample.end());
+        REQUIRE(distinct.size() == 300);
+        for (auto v : sample) REQUIRE(in_window(*v, 30, 60, 200, 250));
+    }
+
+    SECTION("Asking for more than the window holds returns all of it") {
+        auto window = makeRect({0, 0}, {10, 10});
+        auto sample = tree.sample(window, 100, rng);
+        REQUIRE(sample.size() == tree.search(window).size());
+    }
+
+    SECTION("Every entry in the window is equally likely") {
+        // the window cuts through nodes on every side, so the rejection steps are exercised
+        auto window = makeRect({50, 50}, {120, 80});
+        std::map<int, int> hits;
+        const int draws = 40000;
+        for (int i = 0; i < draws; i++) {
+            auto sample = tree.sample(window, 1, rng);
+            REQUIRE(sample.size() == 1);
+            REQUIRE(in_window(*sample[0], 50, 50, 120, 80));
+            hits[*sample[0]]++;
+        }
+        auto matches = tree.search(window).size();
+        REQUIRE(hits.size() == matches);
+        double expected = double(draws) / matches;
+        for (auto [v, n] : hits) {
+            REQUIRE(n > expected * 0.7);
+            REQUIRE(n < expected * 1.3);
+        }
+    }
+}
+
+TEST_CASE("RTree top-k tests", "[top_k]") {
+    Gutman::RTree<int> tree(4, 8);
+    REQUIRE_THROWS(tree.top_k(makeRect({0, 0}, {10, 10}), 3));
+    tree.enable_scores([](const int& v) { return v; });
+    REQUIRE(tree.top_k(makeRect({0, 0}, {10, 10}), 3).empty());
+
+    const int N = 4000;
+    std::vector<int> values(N);
+    std::vector<Rectangle> rects;
+    std::mt19937 rng(23);
+    std::uniform_int_distribution<int> coord(0, 1000), magnitude(0, 100000);
+    for (int i = 0; i < N; i++) {
+        values[i] = magnitude(rng);
+        double x = coord(rng), y = coord(rng);
+        rects.push_back(makeRect({x, y}, {x + 5, y + 5}));
+        tree.insert(rects.back(), &values[i]);
+    }
+
+    auto expected_top = [&](const Rectangle& window, size_t k) {
+        std::vector<int> in_window;
+        for (auto v : tree.search(window)) in_window.push_back(*v);
+        std::sort(in_window.rbegin(), in_window.rend());
+        in_window.resize(std::min(k, in_window.size()));
+        return in_window;
+    };
+    auto scores = [](const auto& found) {
+        std::vector<int> result;
+        for (auto v : found) result.push_back(*v);
+        return result;
+    };
+
+    SECTION("Best entries in the window, best first") {
+        auto window = makeRect({100, 200}, {600, 500});
+        REQUIRE(scores(tree.top_k(window, 20)) == expected_top(window, 20));
+        REQUIRE(scores(tree.top_k(window, 1)) == expected_top(window, 1));
+    }
+
+    SECTION("k larger than the window returns all of it") {
+        auto window = makeRect({0, 0}, {40, 40});
+        REQUIRE(scores(tree.top_k(window, 1000)) == expected_top(window, 1000));
+    }
+
+    SECTION("Scores follow removals and rescoring") {
+        for (int i = 0; i < N; i += 2) tree.remove(rects[i]);
+        auto window = makeRect({0, 0}, {1000, 1000});
+        REQUIRE(scores(tree.top_k(window, 15)) == expected_top(window, 15));
+
+        tree.enable_scores([](const int& v) { return -v; });
+        auto lowest = scores(tree.top_k(window, 15));
+        auto all = scores(tree.search(window));
+        std::sort(all.begin(), all.end());
+        all.resize(15);
+        REQUIRE(lowest == all);
+    }
+}
+
+TEST_CASE("RTree nearest neighbour tests", "[knn]") {
+    Gutman::RTree<int> tree(4, 8);
+    REQUIRE(tree.nearest({0, 0}, 3).empty());
+    REQUIRE(tree.knn_all(3).empty());
+
+    const int N = 3000;
+    std::vector<int> values(N);
+    std::vector<std::vector<double>> locations;
+    std::mt19937 rng(31);
+    std::uniform_int_distribution<int> coord(0, 3000);
+    for (int i = 0; i < N; i++) {
+        values[i] = i;
+        locations.push_back({double(coord(rng)), double(coord(rng))});
+        tree.insert(makeRect(locations[i], locations[i]), &values[i]);
+    }
+
+    auto dist = [&](const std::vector<double>& p, int i) {
+        double dx = double(p[0] - locations[i][0]), dy = double(p[1] - locations[i][1]);
+        return dx * dx + dy * dy;
+    };
+    // distances to the k nearest entries, skipping `self`
+    auto brute_force = [&](const std::vector<double>& p, size_t k, int self) {
+        std::vector<double> all;
+        for (int i = 0; i < N; i++) {
+            if (i != self)
+                all.push_back(dist(p, i));
+        }
+        std::sort(all.begin(), all.end());
+        all.resize(k);
+        return all;
+    };
+    auto distances = [&](const std::vector<double>& p, const auto& found) {
+        std::vector<double> result;
+        for (auto v : found) result.push_back(dist(p, *v));
+        return result;
+    };
+
+    SECTION("Single query matches brute force") {
+        for (int i = 0; i < 50; i++) {
+            std::vector<double> p{double(coord(rng)), double(coord(rng))};
+            REQUIRE(distances(p, tree.nearest(p, 7)) == brute_force(p, 7, -1));
+        }
+        REQUIRE(tree.nearest({0, 0}, N + 10).size() == N);
+    }
+
+    SECTION("All entries, sequential and parallel") {
+        for (unsigned threads : {1u, 4u}) {
+            auto all = tree.knn_all(5, threads);
+            REQUIRE(all.size() == N);
+            std::set<int*> seen;
+            for (auto& [elem, neighbours] : all) {
+                REQUIRE(seen.insert(elem).second);
+                int i = *elem;
+                REQUIRE(distances(locations[i], neighbours) == brute_force(locations[i], 5, i));
+            }
+        }
+    }
+
+    SECTION("Supplied point set") {
+        std::vector<std::vector<double>> points;
+        for (int i = 0; i < 500; i++) points.push_back({double(coord(rng)), double(coord(rng))});
+        auto found = tree.knn_all(points, 4, 3);
+        REQUIRE(found.size() == points.size());
+        for (size_t i = 0; i < points.size(); i++)
+            REQUIRE(distances(points[i], found[i]) == brute_force(points[i], 4, -1));
+    }
+}
+
+TEST_CASE("RTree self-join tests", "[self_join]") {
+    Gutman::RTree<int> tree(4, 8);
+    int calls = 0;
+    tree.self_join_within(10, [&](int*, int*) { calls++; });
+    REQUIRE(calls == 0);
+
+    const int N = 2000;
+    std::vector<int> values(N + 1);
+    std::vector<std::vector<double>> locations;
+    std::mt19937 rng(37);
+    std::uniform_int_distribution<int> coord(0, 2000);
+    for (int i = 0; i < N; i++) {
+        values[i] = i;
+        locations.push_back({double(coord(rng)), double(coord(rng))});
+        tree.insert(makeRect(locations[i], locations[i]), &values[i]);
+    }
+    // a duplicate location is at distance 0
+    values[N] = N;
+    tree.insert(makeRect(locations[0], locations[0]), &values[N]);
+
+    const double eps = 40;
+    std::set<std::pair<int, int>> expected;
+    auto location = [&](int i) { return i == N ? locations[0] : locations[i]; };
+    for (int i = 0; i <= N; i++) {
+        for (int j = i + 1; j <= N; j++) {
+            double dx = double(location(i)[0] - location(j)[0]);
+            double dy = double(location(i)[1] - location(j)[1]);
+            if (dx * dx + dy * dy <= eps * eps)
+                expected.insert({i, j});
+        }
+    }
+    REQUIRE(expected.size() > 100);
+
+    for (unsigned threads : {1u, 4u}) {
+        std::mutex lock;
+        std::set<std::pair<int, int>> found;
+        size_t visits = 0;
+        tree.self_join_within(
+            eps,
+            [&](int* a, int* b) {
+                std::lock_guard<std::mutex> guard(lock);
+                REQUIRE(a != b);
+                found.insert({std::min(*a, *b), std::max(*a, *b)});
+                visits++;
+            },
+            threads);
+        REQUIRE(visits == found.size());
+        REQUIRE(found == expected);
+    }
+}
+
+TEST_CASE("RTree closest pairs tests", "[closest_pairs]") {
+    Gutman::RTree<int> depots(4, 8);
+    Gutman::RTree<double> demand(4, 8);
+    REQUIRE(Gutman::closest_pairs(depots, demand, 5).empty());
+
+    std::mt19937 rng(41);
+    std::uniform_int_distribution<int> coord(0, 5000);
+    std::vector<int> depot_ids(300);
+    std::vector<double> demand_ids(2000);
+    std::vector<std::vector<double>> depot_at, demand_at;
+    for (int i = 0; i < 300; i++) {
+        depot_ids[i] = i;
+        depot_at.push_back({double(coord(rng)), double(coord(rng))});
+        depots.insert(makeRect(depot_at[i], depot_at[i]), &depot_ids[i]);
+    }
+    for (int i = 0; i < 2000; i++) {
+        demand_ids[i] = i;
+        demand_at.push_back({double(coord(rng)), double(coord(rng))});
+        demand.insert(makeRect(demand_at[i], demand_at[i]), &demand_ids[i]);
+    }
+
+    std::vector<double> all_distances;
+    for (auto& a : depot_at) {
+        for (auto& b : demand_at) {
+            double dx = double(a[0] - b[0]), dy = double(a[1] - b[1]);
+            all_distances.push_back(std::sqrt(dx * dx + dy * dy));
+        }
+    }
+    std::sort(all_distances.begin(), all_distances.end());
+
+    for (size_t k : {1, 10, 250, 5000}) {
+        auto pairs = Gutman::closest_pairs(depots, demand, k);
+        REQUIRE(pairs.size() == k);
+        std::set<std::pair<int*, double*>> distinct;
+        for (size_t i = 0; i < k; i++) {
+            auto [depot, point, distance] = pairs[i];
+            REQUIRE(distinct.insert({depot, point}).second);
+            auto& a = depot_at[*depot];
+            auto& b = demand_at[int(*point)];
+            double dx = double(a[0] - b[0]), dy = double(a[1] - b[1]);
+            REQUIRE(std::fabs(distance - std::sqrt(dx * dx + dy * dy)) < 1e-9);
+            REQUIRE(std::fabs(distance - all_distances[i]) < 1e-9);
+        }
+    }
+
+    // the other direction, and more pairs than exist
+    Gutman::RTree<int> few(4, 8);
+    for (int i = 0; i < 3; i++) few.insert(makeRect(depot_at[i], depot_at[i]), &depot_ids[i]);
+    REQUIRE(demand.closest_pairs(few, 10000).size() == 6000);
+}
+
+TEST_CASE("RTree explain tests", "[explain]") {
+    Gutman::RTree<int> tree(4, 8);
+    REQUIRE(tree.explain(makeRect({0, 0}, {10, 10})).nodes_visited() == 0);
+
+    const int N = 2000;
+    std::vector<int> values(N);
+    std::mt19937 rng(37);
+    std::uniform_int_distribution<int> coord(0, 1000);
+    for (int i = 0; i < N; i++) {
+        values[i] = i;
+        std::vector<double> p{double(coord(rng)), double(coord(rng))};
+        tree.insert(makeRect(p, p), &values[i]);
+    }
+
+    SECTION("Search report matches the search") {
+        for (int i = 0; i < 30; i++) {
+            double x = coord(rng), y = coord(rng), side = coord(rng) / 4;
+            auto window = makeRect({x, y}, {x + side, y + side});
+            Gutman::QueryStats stats;
+            auto found = tree.search(window, stats);
+            REQUIRE(found.size() == tree.search(window).size());
+            REQUIRE(stats.entries_returned == found.size());
+            REQUIRE(stats.nodes_per_level.size() >= 1);
+            REQUIRE(stats.nodes_per_level[0] == 1);
+            REQUIRE(stats.entries_scanned >= stats.entries_returned);
+            REQUIRE(stats.mbr_tests >= stats.entries_scanned);
+            REQUIRE(stats.elapsed.count() >= 0);
+            auto again = tree.explain(window);
+            REQUIRE(again.nodes_per_level == stats.nodes_per_level);
+            REQUIRE(again.false_positive_leaves == stats.false_positive_leaves);
+        }
+        // the whole space touches every node and finds everything
+        auto all = tree.explain(makeRect({0, 0}, {1000, 1000}));
+        REQUIRE(all.entries_returned == N);
+        REQUIRE(all.entries_scanned == N);
+        REQUIRE(all.false_positive_leaves == 0);
+        auto wider = tree.explain(makeRect({0, 0}, {2000, 2000}));
+        REQUIRE(all.nodes_visited() == wider.nodes_visited());
+    }
+
+    SECTION("Empty window") {
+        auto stats = tree.explain(makeRect({2000, 2000}, {3000, 3000}));
+        REQUIRE(stats.nodes_visited() == 1);
+        REQUIRE(stats.entries_returned == 0);
+        REQUIRE(stats.entries_scanned == 0);
+    }
+
+    SECTION("Nearest neighbour report") {
+        auto everything = tree.explain(makeRect({0, 0}, {1000, 1000}));
+        for (int i = 0; i < 30; i++) {
+            std::vector<double> p{double(coord(rng)), double(coord(rng))};
+            Gutman::QueryStats stats;
+            auto found = tree.nearest(p, 5, stats);
+            REQUIRE(found == tree.nearest(p, 5));
+            REQUIRE(stats.entries_returned == 5);
+            REQUIRE(stats.nodes_per_level[0] == 1);
+            REQUIRE(stats.entries_scanned >= 5);
+            REQUIRE(stats.nodes_visited() < everything.nodes_visited());
+        }
+        REQUIRE(tree.explain_nearest({0, 0}, N + 5).entries_returned == N);
+    }
+
+    SECTION("Report formatting") {
+        std::ostringstream out;
+        out << tree.explain(makeRect({0, 0}, {100, 100}));
+        REQUIRE(out.str().find("nodes per level: 1 ") == 0);
+    }
+}
+
+TEST_CASE("RTree latency histogram tests", "[latency]") {
+    using Gutman::LatencyBuckets;
+    using Gutman::Operation;
+
+    SECTION("Buckets cover every value within 1/16") {
+        std::mt19937_64 rng(41);
+        for (int i = 0; i < 100000; i++) {
+            uint64_t v = rng() >> (rng() % 40 + 24);
+            size_t b = LatencyBuckets::index(v);
+            REQUIRE(b < LatencyBuckets::count);
+            REQUIRE(LatencyBuckets::lower(b) <= v);
+            REQUIRE(v <= LatencyBuckets::upper(b));
+            if (b + 1 < LatencyBuckets::count)  // the top bucket is open ended
+                REQUIRE(LatencyBuckets::upper(b) - LatencyBuckets::lower(b) <=
+                        std::max<uint64_t>(1, LatencyBuckets::lower(b) / 16));
+        }
+        REQUIRE(LatencyBuckets::index(UINT64_MAX) == LatencyBuckets::count - 1);
+    }
+
+    Gutman::RTree<int> tree(4, 8);
+    const int N = 2000;
+    std::vector<int> values(N);
+    std::vector<std::vector<double>> locations;
+    std::mt19937 rng(43);
+    std::uniform_int_distribution<int> coord(0, 1000);
+    for (int i = 0; i < N; i++) {
+        values[i] = i;
+        locations.push_back({double(coord(rng)), double(coord(rng))});
+    }
+
+    // nothing is recorded until asked for
+    tree.insert(makeRect(locations[0], locations[0]), &values[0]);
+    REQUIRE(tree.latency_histogram(Operation::insert).count() == 0);
+
+    tree.enable_latency_histograms();
+    for (int i = 1; i < N; i++) tree.insert(makeRect(locations[i], locations[i]), &values[i]);
+    for (int i = 0; i < 300; i++) {
+        double x = coord(rng), y = coord(rng);
+        tree.search(makeRect({x, y}, {x + 50, y + 50}));
+        tree.nearest({x, y}, 4);
+    }
+    // removals and updates reinsert entries internally; those count towards the outer call
+    for (int i = 0; i < 400; i++) tree.remove(makeRect(locations[i], locations[i]));
+    for (int i = 400; i < 500; i++) {
+        auto moved = makeRect({locations[i][0] + 1, locations[i][1]},
+                              {locations[i][0] + 1, locations[i][1]});
+        tree.update(makeRect(locations[i], locations[i]), moved, &values[i]);
+    }
+
+    auto inserts = tree.latency_histogram(Operation::insert);
+    REQUIRE(inserts.count() == N - 1);
+    REQUIRE(tree.latency_histogram(Operation::search).count() == 300);
+    REQUIRE(tree.latency_histogram(Operation::knn).count() == 300);
+    REQUIRE(tree.latency_histogram(Operation::remove).count() == 400);
+    REQUIRE(tree.latency_histogram(Operation::update).count() == 100);
+
+    uint64_t in_buckets = 0;
+    for (auto& bucket : inserts.buckets()) in_buckets += bucket.count;
+    REQUIRE(in_buckets == inserts.count());
+    REQUIRE(inserts.mean() > 0);
+    REQUIRE(inserts.percentile(0.5) <= inserts.percentile(0.99));
+    REQUIRE(inserts.percentile(0.99) <= inserts.max());
+    REQUIRE(inserts.percentile(1.0) == inserts.max());
+
+    SECTION("Recording from several threads") {
+        std::vector<std::thread> workers;
+        for (int t = 0; t < 4; t++) {
+            workers.emplace_back([&, t] {
+                for (int i = 0; i < 250; i++) tree.search(makeRect({double(t), 0}, {500, 500}));
+            });
+        }
+        for (auto& worker : workers) worker.join();
+        REQUIRE(tree.latency_histogram(Operation::search).count() == 1300);
+    }
+
+    SECTION("Enabling again starts over") {
+        tree.enable_latency_histograms();
+        REQUIRE(tree.latency_histogram(Operation::insert).count() == 0);
+        REQUIRE(tree.latency_histogram(Operation::insert).percentile(0.99) == 0);
+    }
+}
+
+TEST_CASE("RTree memory usage tests", "[memory]") {
+    Gutman::RTree<int> tree(4, 8);
+    REQUIRE(tree.memory_usage().total() == 0);
+
+    // glibc blocks: 8 byte header, 16 byte granularity, 32 bytes at least
+    Gutman::MemoryUsage model;
+    REQUIRE(model.heap(0) == 0);
+    REQUIRE(model.allocator_overhead == 0);
+    model.heap(1);
+    REQUIRE(model.allocator_overhead == 31);
+    model.heap(24);
+    REQUIRE(model.allocator_overhead == 31 + 8);
+    model.heap(40);
+    REQUIRE(model.allocator_overhead == 31 + 8 + 8);
+
+    const int N = 3000;
+    std::vector<int> values(N);
+    std::vector<std::vector<double>> locations;
+    std::mt19937 rng(47);
+    std::uniform_int_distribution<int> coord(0, 1000);
+    for (int i = 0; i < N; i++) {
+        values[i] = i;
+        locations.push_back({double(coord(rng)), double(coord(rng))});
+        tree.insert(makeRect(locations[i], locations[i]), &values[i]);
+    }
+
+    auto usage = tree.memory_usage();
+    REQUIRE(usage.entry_count == N);
+    REQUIRE(usage.entries == N * sizeof(Gutman::LeafEntry<int>));
+    // every entry rectangle holds two 2-d coordinate vectors
+    REQUIRE(usage.rectangles >= N * 4 * sizeof(double));
+    REQUIRE(usage.nodes > 0);
+    REQUIRE(usage.containers > 0);
+    REQUIRE(usage.allocator_overhead > 0);
+    REQUIRE(usage.total() ==
+            usage.nodes + usage.entries + usage.rectangles + usage.containers +
+                usage.allocator_overhead);
+    REQUIRE(usage.bytes_per_entry() > sizeof(Gutman::LeafEntry<int>));
+    REQUIRE(usage.bytes_per_entry() < 1000);
+
+    for (int i = 0; i < N / 2; i++) tree.remove(makeRect(locations[i], locations[i]));
+    auto after = tree.memory_usage();
+    REQUIRE(after.entry_count == N - N / 2);
+    REQUIRE(after.total() < usage.total());
+
+    std::ostringstream out;
+    out << after;
+    REQUIRE(out.str().find("total=") == 0);
+}
+
+TEST_CASE("RTree ordered node tests", "[ordered]") {
+    const int N = 20000;
+    std::vector<int> values(N);
+    std::vector<Rectangle> rects;
+    std::mt19937 rng(41);
+    std::uniform_real_distribution<double> coord(0, 10000), side(0, 20);
+    for (int i = 0; i < N; i++) {
+        values[i] = i;
+        double x = coord(rng), y = coord(rng);
+        rects.push_back(makeRect({x, y}, {x + side(rng), y + side(rng)}));
+    }
+
+    auto brute = [&](const Rectangle& window, const std::vector<bool>& live) {
+        std::multiset<int*> out;
+        for (int i = 0; i < N; i++)
+            if (live[i] && Rectangle::overlap(rects[i], window))
+                out.insert(&values[i]);
+        return out;
+    };
+    auto found = [](const std::vector<int*>& v) { return std::multiset<int*>(v.begin(), v.end()); };
+    auto window = [&] {
+        double x = coord(rng), y = coord(rng), w = coord(rng) / 20;
+        return makeRect({x, y}, {x + w, y + w});
+    };
+
+    SECTION("Wide ordered nodes find the same entries with fewer tests") {
+        Gutman::RTree<int> plain(64, 256), ordered(64, 256);
+        ordered.order_nodes(0);
+        REQUIRE(ordered.get_order_axis() == 0);
+        for (int i = 0; i < N; i++) {
+            plain.insert(rects[i], &values[i]);
+            ordered.insert(rects[i], &values[i]);
+        }
+        std::vector<bool> live(N, true);
+        size_t plain_tests = 0, ordered_tests = 0;
+        for (int q = 0; q < 100; q++) {
+            auto w = window();
+            auto expected = brute(w, live);
+            REQUIRE(found(ordered.search(w)) == expected);
+            REQUIRE(found(plain.search(w)) == expected);
+            size_t visited = 0;
+            ordered.visit(w, [&](int*, const Rectangle&) { visited++; });
+            REQUIRE(visited == expected.size());
+            plain_tests += plain.explain(w).mbr_tests;
+            ordered_tests += ordered.explain(w).mbr_tests;
+        }
+        REQUIRE(ordered_tests * 2 < plain_tests);
+
+        // removals, bulk removals and reinserts keep the order
+        for (int i = 0; i < N; i += 3) {
+            ordered.remove(rects[i]);
+            live[i] = false;
+        }
+        ordered.remove_if(makeRect({0, 0}, {3000, 3000}), [&](int* v, const Rectangle&) {
+            live[*v] = false;
+            return true;
+        });
+        for (int i = 0; i < N; i += 6) {
+            ordered.insert(rects[i], &values[i]);
+            live[i] = true;
+        }
+        for (int q = 0; q < 100; q++) {
+            auto w = window();
+            REQUIRE(found(ordered.search(w)) == brute(w, live));
+        }
+    }
+
+    SECTION("Ordering can be switched on and off on a built tree") {
+        Gutman::RTree<int> tree(8, 128);
+        for (int i = 0; i < N; i++) tree.insert(rects[i], &values[i]);
+        std::vector<bool> live(N, true);
+        for (int axis : {1, -1, 0}) {
+            tree.order_nodes(axis);
+            for (int q = 0; q < 50; q++) {
+                auto w = window();
+                REQUIRE(found(tree.search(w)) == brute(w, live));
+            }
+        }
+    }
+}
+
+TEST_CASE("RTree paged search tests", "[page]") {
+    const int N = 5000;
+    std::vector<int> values(N);
+    std::mt19937 rng(43);
+    std::uniform_real_distribution<double> coord(0, 1000);
+    Gutman::RTree<int> tree(4, 16);
+    for (int i = 0; i < N; i++) {
+        values[i] = i;
+        double x = coord(rng), y = coord(rng);
+        tree.insert(makeRect({x, y}, {x + 2, y + 2}), &values[i]);
+    }
+
+    SECTION("Pages cover the search exactly once") {
+        for (size_t limit : {1, 7, 100, 1000, 10000}) {
+            auto window = makeRect({100, 100}, {700, 800});
+            auto expected = tree.search(window);
+            std::vector<int*> paged;
+            Gutman::PageToken token;
+            size_t pages = 0;
+            while (!token.done) {
+                auto page = tree.search_page(window, limit, token);
+                REQUIRE(page.items.size() <= limit);
+                if (!page.next.done)
+                    REQUIRE(page.items.size() == limit);
+                paged.insert(paged.end(), page.items.begin(), page.items.end());
+                // the text form resumes just the same
+                token = Gutman::PageToken::parse(page.next.str());
+                REQUIRE(token == page.next);
+                pages++;
+            }
+            REQUIRE(paged == expected);
+            REQUIRE(pages <= expected.size() / limit + 2);
+        }
+    }
+
+    SECTION("Edge cases") {
+        auto window = makeRect({0, 0}, {1000, 1000});
+        REQUIRE_THROWS_AS(tree.search_page(window, 0), std::invalid_argument);
+        REQUIRE(tree.search_page(makeRect({2000, 2000}, {3000, 3000}), 10).items.empty());
+        Gutman::PageToken end;
+        end.done = true;
+        REQUIRE(tree.search_page(window, 10, end).items.empty());
+        REQUIRE(Gutman::PageToken::parse("").position.empty());
+        REQUIRE(Gutman::PageToken::parse("end").done);
+        REQUIRE(Gutman::PageToken::parse("3.0.12").position == std::vector<long long>{3, 0, 12});
+        REQUIRE_THROWS_AS(Gutman::PageToken::parse("3..1"), std::invalid_argument);
+        REQUIRE_THROWS_AS(Gutman::PageToken::parse("3.x"), std::invalid_argument);
+        Gutman::RTree<int> empty(4, 8);
+        REQUIRE(empty.search_page(window, 10).next.done);
+    }
+}
@@ -0,0 +1,128 @@
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch_all.hpp>
+
+#include <random>
+#include <sstream>
+
+#include "benchmark/replay.h"
+#include "benchmark/trace.h"
+#include "rtree/rtree.h"
+#include "rtree_hilbert/hilbert_rtree.h"
+
+using trace::Kind;
+using trace::TraceOp;
+
+static std::vector<TraceOp> random_trace(size_t n, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<long long> coord(0, 5000);
+    std::vector<TraceOp> ops;
+    std::vector<std::vector<long long>> at;
+    std::vector<bool> removed(n);
+    for (size_t i = 0; i < n; i++) {
+        std::vector<long long> p{coord(rng), coord(rng)};
+        at.push_back(p);
+        ops.push_back({Kind::insert, i, p, p});
+        if (i % 3 == 0)
+            ops.push_back({Kind::search, 0, p, {p[0] + 200, p[1] + 300}});
+        if (i % 7 == 6 && !removed[i - 3]) {
+            auto& q = at[i - 3];
+            ops.push_back({Kind::update, i - 3, q, q, {q[0] + 1, q[1]}, {q[0] + 1, q[1]}});
+            q[0]++;
+        }
+        if (i % 11 == 10) {
+            ops.push_back({Kind::remove, i - 1, at[i - 1], at[i - 1]});
+            removed[i - 1] = true;
+        }
+    }
+    return ops;
+}
+
+TEST_CASE("Trace round trip tests", "[trace]") {
+    auto ops = random_trace(2000, 51);
+    std::stringstream buffer;
+    trace::TraceWriter writer(buffer, 2);
+    for (auto& op : ops) writer.write(op);
+    // point data at deltas of a few thousand fits in a handful of bytes per coordinate
+    REQUIRE(buffer.str().size() < ops.size() * 16);
+
+    trace::TraceReader reader(buffer);
+    REQUIRE(reader.dims() == 2);
+    auto back = reader.read_all();
+    REQUIRE(back.size() == ops.size());
+    for (size_t i = 0; i < ops.size(); i++) {
+        REQUIRE(back[i].kind == ops[i].kind);
+        REQUIRE(back[i].id == ops[i].id);
+        REQUIRE(back[i].lo == ops[i].lo);
+        REQUIRE(back[i].hi == ops[i].hi);
+        REQUIRE(back[i].to_lo == ops[i].to_lo);
+        REQUIRE(back[i].to_hi == ops[i].to_hi);
+    }
+
+    SECTION("Negative and extreme coordinates") {
+        std::stringstream extreme;
+        trace::TraceWriter w(extreme, 1);
+        std::vector<TraceOp> odd = {{Kind::insert, UINT64_MAX, {-5}, {7}},
+                                    {Kind::search, 0, {LLONG_MIN}, {LLONG_MAX}},
+                                    {Kind::remove, 0, {LLONG_MAX}, {LLONG_MAX}}};
+        for (auto& op : odd) w.write(op);
+        auto read = trace::TraceReader(extreme).read_all();
+        REQUIRE(read.size() == 3);
+        REQUIRE(read[0].id == UINT64_MAX);
+        REQUIRE(read[0].lo == std::vector<long long>{-5});
+        REQUIRE(read[1].lo == std::vector<long long>{LLONG_MIN});
+        REQUIRE(read[1].hi == std::vector<long long>{LLONG_MAX});
+        REQUIRE(read[2].lo == std::vector<long long>{LLONG_MAX});
+    }
+
+    SECTION("Bad input") {
+        std::stringstream wrong("not a trace");
+        REQUIRE_THROWS_AS(trace::TraceReader(wrong), std::runtime_error);
+        std::stringstream truncated(buffer.str().substr(0, buffer.str().size() - 1));
+        trace::TraceReader partial(truncated);
+        REQUIRE_THROWS_AS(partial.read_all(), std::runtime_error);
+        std::stringstream out;
+        trace::TraceWriter w(out, 2);
+        REQUIRE_THROWS_AS(w.write({Kind::insert, 1, {0}, {0}}), std::invalid_argument);
+        REQUIRE_THROWS_AS(w.write({Kind::insert, 1, {5, 5}, {4, 6}}), std::invalid_argument);
+    }
+}
+
+TEST_CASE("Trace replay tests", "[trace]") {
+    auto ops = random_trace(3000, 53);
+    size_t inserts = 0, removes = 0, updates = 0, searches = 0;
+    for (auto& op : ops) {
+        inserts += op.kind == Kind::insert;
+        removes += op.kind == Kind::remove;
+        updates += op.kind == Kind::update;
+        searches += op.kind == Kind::search;
+    }
+
+    for (unsigned threads : {1u, 3u}) {
+        Gutman::RTree<uint64_t> gutman(4, 8);
+        auto g = trace::replay(gutman, ops, threads, [](const auto& lo, const auto& hi) {
+            return Gutman::Rectangle(std::vector<double>(lo.begin(), lo.end()),
+                                     std::vector<double>(hi.begin(), hi.end()));
+        });
+        hilbert::RTree<uint64_t> hilb(4, 8, 2, 16);
+        auto h = trace::replay(hilb, ops, threads, [](const auto& lo, const auto& hi) {
+            return hilbert::Rectangle(lo, hi);
+        });
+
+        for (auto& result : {g, h}) {
+            REQUIRE(result.threads == threads);
+            REQUIRE(result.ops == ops.size());
+            REQUIRE(result.throughput() > 0);
+            REQUIRE(result.latency[size_t(Gutman::Operation::insert)].count() == inserts);
+            REQUIRE(result.latency[size_t(Gutman::Operation::remove)].count() == removes);
+            REQUIRE(result.latency[size_t(Gutman::Operation::update)].count() == updates);
+            REQUIRE(result.latency[size_t(Gutman::Operation::search)].count() == searches);
+        }
+        // single threaded replays keep trace order, so both trees end up with the same entries
+        if (threads == 1) {
+            Gutman::Rectangle everything_g({0, 0}, {6000, 6000});
+            hilbert::Rectangle everything_h({0, 0}, {6000, 6000});
+            REQUIRE(gutman.search(everything_g).size() == inserts - removes);
+            REQUIRE(hilb.search(everything_h).size() == inserts - removes);
+        }
+    }
+}